@@ -94,6 +94,16 @@ typedef intptr_t VstIntPtr;
 #include <cstdlib>
 #include <limits>
 
+#ifdef PARAMQUEUE
+#include "remoteplugin.h"
+#endif
+
+#ifdef SHMCHUNK
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 //#include "public.sdk/source/vst/hosting/eventlist.cpp"
 //#include "public.sdk/source/vst/hosting/hostclasses.cpp"
@@ -286,6 +296,144 @@ protected:
   HostAttributeList attrList;
 };
 
+#ifdef SHMCHUNK
+//------------------------------------------------------------------------
+// ShmChunkStream
+//------------------------------------------------------------------------
+IMPLEMENT_FUNKNOWN_METHODS(ShmChunkStream, IBStream, IBStream::iid)
+
+ShmChunkStream::ShmChunkStream()
+    : memory(nullptr), capacity(0), size(0), base(0), cursor(0), fd(-1) {
+  FUNKNOWN_CTOR
+}
+
+ShmChunkStream::~ShmChunkStream() {
+  if (memory)
+    munmap(memory, capacity);
+  if (fd >= 0)
+    close(fd);
+  FUNKNOWN_DTOR
+}
+
+bool ShmChunkStream::open() {
+  if (fd < 0)
+    fd = syscall(SYS_memfd_create, "rplugin_state", MFD_CLOEXEC);
+
+  if (fd < 0 || !reserve(1024 * 1024))
+    return false;
+
+  size = 0;
+  base = 0;
+  cursor = 0;
+  return true;
+}
+
+// the file only grows, the client may still have the last chunk mapped
+bool ShmChunkStream::reserve(TSize newSize) {
+  if (newSize <= capacity)
+    return true;
+  if (fd < 0)
+    return false;
+
+  TSize newCapacity = capacity ? capacity : 1024 * 1024;
+  while (newCapacity < newSize)
+    newCapacity *= 2;
+
+  if (ftruncate(fd, newCapacity) != 0)
+    return false;
+
+  void *mem;
+  if (memory)
+    mem = mremap(memory, capacity, newCapacity, MREMAP_MAYMOVE);
+  else
+    mem = mmap(0, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (mem == MAP_FAILED)
+    return false;
+
+  memory = (char *)mem;
+  capacity = newCapacity;
+  return true;
+}
+
+void ShmChunkStream::section(TSize start) {
+  base = start;
+  cursor = start;
+}
+
+void ShmChunkStream::setSize(TSize newSize) {
+  size = newSize;
+  if (cursor > size)
+    cursor = size;
+}
+
+tresult PLUGIN_API ShmChunkStream::read(void *buffer, int32 numBytes,
+                                        int32 *numBytesRead) {
+  if (numBytes < 0 || cursor >= size)
+    numBytes = 0;
+  else if (cursor + numBytes > size)
+    numBytes = (int32)(size - cursor);
+
+  if (numBytes > 0) {
+    memcpy(buffer, &memory[cursor], numBytes);
+    cursor += numBytes;
+  }
+
+  if (numBytesRead)
+    *numBytesRead = numBytes;
+  return kResultTrue;
+}
+
+tresult PLUGIN_API ShmChunkStream::write(void *buffer, int32 numBytes,
+                                         int32 *numBytesWritten) {
+  if (numBytesWritten)
+    *numBytesWritten = 0;
+  if (numBytes < 0 || !buffer)
+    return kInvalidArgument;
+  if (!reserve(cursor + numBytes))
+    return kOutOfMemory;
+
+  memcpy(&memory[cursor], buffer, numBytes);
+  cursor += numBytes;
+  if (cursor > size)
+    size = cursor;
+
+  if (numBytesWritten)
+    *numBytesWritten = numBytes;
+  return kResultTrue;
+}
+
+tresult PLUGIN_API ShmChunkStream::seek(int64 pos, int32 mode,
+                                        int64 *result) {
+  switch (mode) {
+  case kIBSeekSet:
+    cursor = base + pos;
+    break;
+  case kIBSeekCur:
+    cursor = cursor + pos;
+    break;
+  case kIBSeekEnd:
+    cursor = size + pos;
+    break;
+  }
+
+  if (cursor < base)
+    cursor = base;
+
+  if (result)
+    *result = cursor - base;
+  return kResultTrue;
+}
+
+tresult PLUGIN_API ShmChunkStream::tell(int64 *pos) {
+  if (!pos)
+    return kInvalidArgument;
+
+  *pos = cursor - base;
+  return kResultTrue;
+}
+#endif
+
 //------------------------------------------------------------------------
 // BaseWrapper
 //------------------------------------------------------------------------
@@ -642,6 +790,44 @@ void BaseWrapper::getUnitPath(UnitID unitID, String &path) const {
 int32 BaseWrapper::_getChunk(void **data, bool isPreset) {
   // Host stores Plug-in state. Returns the size in bytes of the chunk (Plug-in
   // allocates the data array)
+#ifdef SHMCHUNK
+  // component and controller write straight into the shared file, the
+  // header with both sizes is filled in afterwards
+  mShmChunkUsed = false;
+
+  if (mShmChunk.open()) {
+    int64 sizes[2] = {0, 0};
+    TSize start = sizeof(sizes);
+
+    mShmChunk.write(sizes, sizeof(sizes), nullptr);
+
+    mShmChunk.section(start);
+    if (mComponent && mComponent->getState(&mShmChunk) == kResultTrue)
+      sizes[0] = mShmChunk.getSize() - start;
+    else
+      mShmChunk.setSize(start);
+
+    start = mShmChunk.getSize();
+    mShmChunk.section(start);
+    if (mController && mController->getState(&mShmChunk) == kResultTrue)
+      sizes[1] = mShmChunk.getSize() - start;
+    else
+      mShmChunk.setSize(start);
+
+    if (sizes[0] + sizes[1] == 0)
+      return 0;
+
+    mShmChunk.section(0);
+    IBStreamer acc(&mShmChunk, kLittleEndian);
+    acc.writeInt64(sizes[0]);
+    acc.writeInt64(sizes[1]);
+
+    mShmChunkUsed = true;
+    *data = mShmChunk.getData();
+    return (int32)mShmChunk.getSize();
+  }
+#endif
+
   MemoryStream componentStream;
   if (mComponent && mComponent->getState(&componentStream) != kResultTrue)
     componentStream.setSize(0);
@@ -880,9 +1066,15 @@ void BaseWrapper::setupParameters() {
 
   mNumParams = (int32)mParameterMap.size();
 
+#ifdef PARAMQUEUE
+  // a queued block can carry several points per parameter
+  mInputTransfer.setMaxParameters(paramCount + PARQUEUECOUNT);
+  mGuiTransfer.setMaxParameters(paramCount + PARQUEUECOUNT);
+#else
   mInputTransfer.setMaxParameters(paramCount);
-  mOutputTransfer.setMaxParameters(paramCount);
   mGuiTransfer.setMaxParameters(paramCount);
+#endif
+  mOutputTransfer.setMaxParameters(paramCount);
   mInputChanges.setMaxParameters(paramCount);
   mOutputChanges.setMaxParameters(paramCount);
 
@@ -1249,6 +1441,10 @@ tresult PLUGIN_API BaseWrapper::restartComponent(int32 flags) {
 
   //--- ----------------------
   if ((flags & kParamValuesChanged) || (flags & kParamTitlesChanged)) {
+#ifdef PMETA
+    if (flags & kParamTitlesChanged)
+      _paramTitlesChanged();
+#endif
     _updateDisplay();
     result = kResultTrue;
   }
@@ -1728,6 +1924,20 @@ void Vst2Wrapper::setParameter(VstInt32 index, float value) {
   }
 }
 
+#ifdef PARAMQUEUE
+//------------------------------------------------------------------------
+void Vst2Wrapper::setParameterAt(VstInt32 index, float value,
+                                 VstInt32 sampleOffset) {
+  if (!mController)
+    return;
+
+  if (index >= 0 && index < (int32)mParameterMap.size()) {
+    ParamID id = mParameterMap.at(index).vst3ID;
+    addParameterChange(id, (ParamValue)value, sampleOffset);
+  }
+}
+#endif
+
 //------------------------------------------------------------------------
 void Vst2Wrapper::setProgram(VstInt32 program) {
   if (mProgramParameterID != kNoParamId && mController != nullptr &&
@@ -1874,6 +2084,30 @@ bool Vst2Wrapper::canParameterBeAutomated(VstInt32 index) {
   return false;
 }
 
+#ifdef PMETA
+//------------------------------------------------------------------------
+bool Vst2Wrapper::getParameterMeta(VstInt32 index, int *automate, int *steps,
+                                   int *flags, float *defvalue) {
+  *automate = 0;
+  *steps = 0;
+  *flags = 0;
+  *defvalue = 0;
+  if (mController && index < (int32)mParameterMap.size()) {
+    int32 vst3Index = mParameterMap.at(index).vst3Index;
+
+    ParameterInfo paramInfo = {0};
+    if (mController->getParameterInfo(vst3Index, paramInfo) == kResultTrue) {
+      *automate = (paramInfo.flags & ParameterInfo::kCanAutomate) != 0;
+      *steps = paramInfo.stepCount;
+      *flags = paramInfo.flags;
+      *defvalue = (float)paramInfo.defaultNormalizedValue;
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
 //------------------------------------------------------------------------
 bool Vst2Wrapper::string2parameter(VstInt32 index, char *text) {
   if (mController && index < (int32)mParameterMap.size()) {
@@ -2077,6 +2311,17 @@ VstInt32 Vst2Wrapper::processEvents(VstEvents *events) {
           midiEvent->flags & kVstMidiEventIsRealtime, midiEvent->noteLength,
           midiEvent->noteOffVelocity * kMidiScaler, midiEvent->detune);
     }
+#ifdef SYSEX
+    else if (e->type == kVstSysExType) {
+      auto *sysexEvent = (VstMidiSysexEvent *)e;
+      Event toAdd = {0, sysexEvent->deltaFrames, 0};
+      toAdd.type = Event::kDataEvent;
+      toAdd.data.type = DataEvent::kMidiSysEx;
+      toAdd.data.size = sysexEvent->dumpBytes;
+      toAdd.data.bytes = (const uint8 *)sysexEvent->sysexDump;
+      mInputEvents->addEvent(toAdd);
+    }
+#endif
     //--- -----------------------------
   }
 
@@ -2325,6 +2570,15 @@ void Vst2Wrapper::_updateDisplay() {
   //	updateDisplay ();
 }
 
+#ifdef PMETA
+//-----------------------------------------------------------------------------
+void Vst2Wrapper::_paramTitlesChanged() {
+  // lets the server rebuild the parameter table it shares with the client
+  if (audioMaster)
+    audioMaster(0, audioMasterUpdateDisplay, 0, kParamTitlesChanged, 0, 0);
+}
+#endif
+
 //-----------------------------------------------------------------------------
 void Vst2Wrapper::_setNumInputs(int32 inputs) {
   BaseWrapper::_setNumInputs(inputs);
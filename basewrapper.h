@@ -98,6 +98,45 @@ protected:
 //------------------------------------------------------------------------
 const int32 kMaxEvents = 2048;
 
+#ifdef SHMCHUNK
+//------------------------------------------------------------------------
+// IBStream on a memfd, the server hands the file to the client so the
+// state the plugin writes is not copied again. Positions are relative to
+// the start of the current section.
+//------------------------------------------------------------------------
+class ShmChunkStream : public IBStream {
+public:
+  ShmChunkStream();
+  virtual ~ShmChunkStream();
+
+  tresult PLUGIN_API read(void *buffer, int32 numBytes,
+                          int32 *numBytesRead) SMTG_OVERRIDE;
+  tresult PLUGIN_API write(void *buffer, int32 numBytes,
+                           int32 *numBytesWritten) SMTG_OVERRIDE;
+  tresult PLUGIN_API seek(int64 pos, int32 mode, int64 *result) SMTG_OVERRIDE;
+  tresult PLUGIN_API tell(int64 *pos) SMTG_OVERRIDE;
+
+  bool open();
+  void section(TSize start);
+  void setSize(TSize newSize);
+  TSize getSize() const { return size; }
+  char *getData() const { return memory; }
+  int getFd() const { return fd; }
+
+  DECLARE_FUNKNOWN_METHODS
+
+protected:
+  bool reserve(TSize newSize);
+
+  char *memory;
+  TSize capacity;
+  TSize size;
+  TSize base;
+  int64 cursor;
+  int fd;
+};
+#endif
+
 //-------------------------------------------------------------------------------------------------------
 class BaseWrapper : public IHostApplication,
                     public IComponentHandler,
@@ -124,11 +163,24 @@ public:
 
   virtual void _ioChanged() {}
   virtual void _updateDisplay() {}
+#ifdef PMETA
+  virtual void _paramTitlesChanged() {}
+#endif
   virtual void _setNumInputs(int32 inputs) { mNumInputs = inputs; }
   virtual void _setNumOutputs(int32 outputs) { mNumOutputs = outputs; }
   virtual bool _sizeWindow(int32 width, int32 height) = 0;
   virtual int32 _getChunk(void **data, bool isPreset);
   virtual int32 _setChunk(void *data, int32 byteSize, bool isPreset);
+#ifdef SHMCHUNK
+  int _getChunkFd() const { return mShmChunkUsed ? mShmChunk.getFd() : -1; }
+#endif
+#ifdef ASYNCLOAD
+  // events handed over for a block that is not processed
+  void _clearInputEvents() {
+    if (mInputEvents)
+      mInputEvents->clear();
+  }
+#endif
 
   virtual bool getEditorSize(int32 &width, int32 &height) const;
 
@@ -268,6 +320,10 @@ protected:
   ParameterChangeTransfer mGuiTransfer;
 
   MemoryStream mChunk;
+#ifdef SHMCHUNK
+  ShmChunkStream mShmChunk;
+  bool mShmChunkUsed = false;
+#endif
 
   IPtr<Timer> mTimer;
   IPtr<IPluginFactory> mFactory;
@@ -70,6 +70,10 @@ static const Steinberg::FIDString kExitModuleProcName = "ExitDll";
 #ifdef TRACKTIONWM
 #define APPLICATION_CLASS_NAME2 "dssi_vst2"
 #endif
+#ifdef MULTISERVER
+// plugin instances one server process can host
+#define MULTISLOTS 256
+#endif
 #define OLD_PLUGIN_ENTRY_POINT "main"
 #define NEW_PLUGIN_ENTRY_POINT "VSTPluginMain"
 
@@ -131,20 +135,22 @@ public:
 #ifdef PCACHE
       int val = vst2wrap->numparams;
       
-      numpars = val;
-      
-      ParamState p;
+      // a plugin may report more parameters later than the cache was made
+      // for, the host only knows the count it was given first
+      numpars = std::min(val, m_parcache.count);
   
-      for (int i = 0; i < val; ++i)
+      for (int i = 0; i < numpars; ++i)
       {
-      if(i >= 10000)
-      break;
-      p.changed = 0;   
       float value = getParameter(i);      
-      p.value = value;   
-      p.valueupdate = value;        
-      memcpy(&m_shm6[i * sizeof(ParamState)], &p, sizeof(ParamState));      
+      m_parcache.value[i] = value;   
+      m_parcache.update[i] = value;        
       }   
+
+      if (m_shm6)
+      pdirtyclear(&m_parcache);
+#ifdef PDISPLAY
+      pdisplayinvalall(&m_parcache);
+#endif
        
       return val;                   
 #else        
@@ -154,6 +160,9 @@ public:
   virtual std::string getParameterName(int);
   virtual std::string getParameterLabel(int);
   virtual std::string getParameterDisplay(int);
+#ifdef PMETA
+  virtual void getParameterMeta(int, ParamMeta *);
+#endif
   virtual void setParameter(int, float);
   virtual float getParameter(int);
   virtual void getParameters(int, int, float *);
@@ -184,6 +193,9 @@ public:
   //    virtual int         getVersion() { return m_plugin->version;}
 
   virtual int processVstEvents();
+#ifdef PARAMQUEUE
+  virtual void processParamQueue();
+#endif
 
   virtual void getChunk(ShmControl *m_shmControlptr);
   virtual void setChunk(ShmControl *m_shmControlptr);
@@ -193,6 +205,9 @@ public:
   //    virtual void        eff_mainsChanged(int v);
 
   virtual void process(float **inputs, float **outputs, int sampleFrames);
+#ifdef PCACHE
+  void parFlush();
+#endif
 #ifdef DOUBLEP
   virtual void processdouble(double **inputs, double **outputs,
                              int sampleFrames);
@@ -232,12 +247,20 @@ public:
 
   HWND hWnd;
   WNDCLASSEX wclass;
+  // per instance so that instances sharing a process can register it
+  std::string className;
+  HMODULE libHandle;
+#ifdef MULTISERVER
+  int slot;
+#endif
 #ifdef DRAGWIN   
   HWINEVENTHOOK g_hook;
   HCURSOR hCurs1;
   HCURSOR hCurs2;
   Window drag_win;
   int dodragwin;   
+  // wakes GetSetThreadMain when a drag starts or the instance exits
+  HANDLE hDragStart;
   Window window;
   HWND winehwnd;		
   int xdndversion;				
@@ -353,6 +376,30 @@ public:
   int audfin;
   int getfin;
   int confin;  
+  int watchfin;
+  HANDLE hControlDone;
+  HANDLE hControlWatch;
+#ifdef FUTEXWAITV
+  int dispatchv;
+  std::atomic_int controlDone;
+#endif
+#ifdef ASYNCLOAD
+  HANDLE hLoadThread;
+  std::atomic_int loadstate;
+  std::atomic_int loadinblock;
+  char *loadptr;
+  int loadsz;
+  int loadbank;
+  size_t loadmapsize;
+
+  bool loadStart(ShmControl *m_shmControlptr);
+  void loadRun();
+  void loadWait();
+  bool loadEnter();
+#ifdef PCACHE
+  void parRefresh();
+#endif
+#endif
   int hidegui;	
   
 #ifdef PCACHE
@@ -373,7 +420,65 @@ private:
 
 RemoteVSTServer *remoteVSTServerInstance = 0;
 
+// wakes the main thread out of mainWait, see ControlWatchMain
+HANDLE controlWake = 0;
+
+// sleeps until a window message arrives or controlWake is set, the main
+// thread has no other timeout when nothing is happening
+void mainWait(DWORD timeout) {
+  MsgWaitForMultipleObjectsEx(1, &controlWake, timeout, QS_ALLINPUT,
+                              MWMO_INPUTAVAILABLE);
+}
+
+// tells the control watcher that the main thread has served its request
+void controlServed(RemoteVSTServer *remoteVSTServerInstance) {
+#ifdef FUTEXWAITV
+  if (remoteVSTServerInstance->dispatchv) {
+    remoteVSTServerInstance->controlDone.store(1, std::memory_order_seq_cst);
+    syscall(SYS_futex, &remoteVSTServerInstance->controlDone, FUTEX_WAKE, 1,
+            NULL, NULL, 0);
+    return;
+  }
+#endif
+  SetEvent(remoteVSTServerInstance->hControlDone);
+}
+
+#ifdef MULTISERVER
+// all instances hosted by this process, only touched from the main thread
+std::vector<RemoteVSTServer *> remoteVSTServerInstances;
+// instance per host callback slot, see hostCallbackSlot
+RemoteVSTServer *remoteVSTServerSlots[MULTISLOTS];
+#endif
+
+RemoteVSTServer *instanceForWindow(HWND hWnd) {
+#ifdef MULTISERVER
+  for (RemoteVSTServer *instance : remoteVSTServerInstances) {
+    if (instance->hWnd == hWnd)
+      return instance;
+  }
+  return 0;
+#else
+  return remoteVSTServerInstance;
+#endif
+}
+
+#ifdef DRAGWIN
+RemoteVSTServer *instanceForHook(HWINEVENTHOOK hook) {
+#ifdef MULTISERVER
+  for (RemoteVSTServer *instance : remoteVSTServerInstances) {
+    if (instance->g_hook == hook)
+      return instance;
+  }
+  return 0;
+#else
+  return remoteVSTServerInstance;
+#endif
+}
+#endif
+
 LRESULT WINAPI MainProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+  RemoteVSTServer *remoteVSTServerInstance = instanceForWindow(hWnd);
+
   switch (msg) {
   case WM_CLOSE:
 #ifndef EMBED
@@ -422,6 +527,8 @@ LRESULT WINAPI MainProc2(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 #endif
 
 DWORD WINAPI AudioThreadMain(LPVOID parameter) {
+  RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
+
   /*
       struct sched_param param;
       param.sched_priority = 1;
@@ -433,8 +540,11 @@ DWORD WINAPI AudioThreadMain(LPVOID parameter) {
           perror("Failed to set realtime priority for audio thread");
       }
  */ 
+#ifdef AMRING
+  remoteVSTServerInstance->m_audiothreadid = GetCurrentThreadId();
+#endif
   while (!remoteVSTServerInstance->exiting) {
-    remoteVSTServerInstance->dispatchProcess(5);
+    remoteVSTServerInstance->dispatchProcess(-1);
   }
   // param.sched_priority = 0;
   // (void)sched_setscheduler(0, SCHED_OTHER, &param);
@@ -493,6 +603,7 @@ int x, y;
 
 #ifdef DRAGWIN   
 DWORD WINAPI GetSetThreadMain(LPVOID parameter) {
+RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
 POINT point;
 Window groot;
 Window gchild;
@@ -528,6 +639,12 @@ char mret;
    (void)sched_setscheduler(0, SCHED_OTHER, &param);
 */
   while (!remoteVSTServerInstance->exiting) {
+
+  if(remoteVSTServerInstance->dodragwin == 0)
+  {
+  WaitForSingleObject(remoteVSTServerInstance->hDragStart, INFINITE);
+  continue;
+  }
   
   if(remoteVSTServerInstance->dodragwin == 1)
   {  
@@ -834,6 +951,8 @@ char mret;
 #endif
 
 DWORD WINAPI ParThreadMain(LPVOID parameter) {
+  RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
+
   /*
       struct sched_param param;
       param.sched_priority = 1;
@@ -846,7 +965,7 @@ DWORD WINAPI ParThreadMain(LPVOID parameter) {
       }
   */
   while (!remoteVSTServerInstance->exiting) {
-    remoteVSTServerInstance->dispatchPar(5);
+    remoteVSTServerInstance->dispatchPar(-1);
   }
   // param.sched_priority = 0;
   // (void)sched_setscheduler(0, SCHED_OTHER, &param);
@@ -856,6 +975,8 @@ DWORD WINAPI ParThreadMain(LPVOID parameter) {
 }
 
 DWORD WINAPI ControlThreadMain(LPVOID parameter) {
+  RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
+
   /*
       struct sched_param param;
       param.sched_priority = 1;
@@ -868,7 +989,7 @@ DWORD WINAPI ControlThreadMain(LPVOID parameter) {
       }
   */
   while (!remoteVSTServerInstance->exiting) {
-    remoteVSTServerInstance->dispatchControl2(5);
+    remoteVSTServerInstance->dispatchControl2(-1);
   }
   // param.sched_priority = 0;
   // (void)sched_setscheduler(0, SCHED_OTHER, &param);
@@ -877,6 +998,81 @@ DWORD WINAPI ControlThreadMain(LPVOID parameter) {
   return 0;
 }
 
+// The control channel is served on the main thread because of the gui, which
+// sleeps in mainWait. This thread sleeps on the channel's futex instead and
+// wakes the main thread when a request arrives, then waits until it has been
+// dispatched so the same request is not signalled twice.
+DWORD WINAPI ControlWatchMain(LPVOID parameter) {
+  RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
+
+  while (!remoteVSTServerInstance->exiting) {
+    remoteVSTServerInstance->fpeek(
+        remoteVSTServerInstance->m_shmControl3,
+        &remoteVSTServerInstance->m_shmControl3->runServer);
+    if (remoteVSTServerInstance->exiting)
+      break;
+    SetEvent(controlWake);
+    WaitForSingleObject(remoteVSTServerInstance->hControlDone, INFINITE);
+  }
+  remoteVSTServerInstance->watchfin = 1;
+  ExitThread(0);
+  return 0;
+}
+
+#ifdef FUTEXWAITV
+// Serves the parameter and control2 channels and watches the control channel
+// for the main thread from one thread with futex_waitv, replacing
+// ParThreadMain, ControlThreadMain and ControlWatchMain. While a control
+// request is with the main thread, controlDone is watched instead.
+DWORD WINAPI DispatchThreadMain(LPVOID parameter) {
+  RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
+  ShmControl *controls[3];
+  std::atomic_int *words[3];
+  int pending = 0;
+
+  while (!remoteVSTServerInstance->exiting) {
+    int count = 0;
+#ifndef PCACHE
+    controls[count] = remoteVSTServerInstance->m_shmControl5;
+    words[count++] = &remoteVSTServerInstance->m_shmControl5->runServer;
+#endif
+    controls[count] = remoteVSTServerInstance->m_shmControl6;
+    words[count++] = &remoteVSTServerInstance->m_shmControl6->runServer;
+    if (pending) {
+      controls[count] = 0;
+      words[count++] = &remoteVSTServerInstance->controlDone;
+    } else {
+      controls[count] = remoteVSTServerInstance->m_shmControl3;
+      words[count++] = &remoteVSTServerInstance->m_shmControl3->runServer;
+    }
+
+    remoteVSTServerInstance->fwaitv(controls, words, count);
+
+    if (remoteVSTServerInstance->exiting)
+      break;
+
+#ifndef PCACHE
+    if (remoteVSTServerInstance->m_shmControl5->runServer > 0)
+      remoteVSTServerInstance->dispatchPar(0);
+#endif
+    if (remoteVSTServerInstance->m_shmControl6->runServer > 0)
+      remoteVSTServerInstance->dispatchControl2(0);
+
+    if (pending && remoteVSTServerInstance->controlDone.exchange(0))
+      pending = 0;
+    if (!pending && remoteVSTServerInstance->m_shmControl3->runServer > 0) {
+      pending = 1;
+      SetEvent(controlWake);
+    }
+  }
+  remoteVSTServerInstance->parfin = 1;
+  remoteVSTServerInstance->confin = 1;
+  remoteVSTServerInstance->watchfin = 1;
+  ExitThread(0);
+  return 0;
+}
+#endif
+
 RemoteVSTServer::RemoteVSTServer(std::string fileIdentifiers,
                                  std::string fallbackName)
     : RemotePluginServer(fileIdentifiers), m_name(fallbackName), m_maker(""),
@@ -887,15 +1083,28 @@ hosttracktion(0),
 #endif
 #endif
       haveGui(true), exiting(false), effectrun(false), inProcessThread(false),
-      guiVisible(false), parfin(0), audfin(0), getfin(0), confin(0), guiupdate(0),
+      guiVisible(false), parfin(0), audfin(0), getfin(0), confin(0), watchfin(0),
+      hControlDone(0), hControlWatch(0),
+#ifdef FUTEXWAITV
+      dispatchv(0), controlDone(0),
+#endif
+#ifdef ASYNCLOAD
+      hLoadThread(0), loadstate(0), loadinblock(0), loadptr(0), loadsz(0),
+      loadbank(0), loadmapsize(0),
+#endif
+      guiupdate(0),
       guiupdatecount(0), guiresizewidth(500), guiresizeheight(200), melda(0),
       hWnd(0), display(0), child(0), parent(0), pparent(0), parentok(0), reparentdone(0), vst2wrap(0), factory(0), mpluginptr(&mplugin), vst2uid(0), categnum(1),
 #ifdef DRAGWIN
-dodragwin(0), drag_win(0), pwindow(0), window(0), xdndversion(-1), data(0), data2(0), prevx(-1), prevy(-1), dndfinish(0), dndaccept(0), dropdone(0),  proxyptr(0), winehwnd(0),
+dodragwin(0), hDragStart(0), drag_win(0), pwindow(0), window(0), xdndversion(-1), data(0), data2(0), prevx(-1), prevy(-1), dndfinish(0), dndaccept(0), dropdone(0),  proxyptr(0), winehwnd(0),
 #endif
 #ifdef PCACHE
       numpars(0), 
 #endif                  
+#ifdef MULTISERVER
+      slot(-1),
+#endif
+      className(APPLICATION_CLASS_NAME), libHandle(0),
       hidegui(0), reaptimecount(0) {
 #ifdef EMBED
   /*
@@ -1026,11 +1235,9 @@ void RemoteVSTServer::EffectOpen(ShmControl *m_shmControlptr) {
 
   if ((am.incount != m_numInputs) || (am.outcount != m_numOutputs) ||
       (am.delay != m_delay)) {
-    memcpy(remoteVSTServerInstance->m_shmControl->amptr, &am, sizeof(am));
-    remoteVSTServerInstance->m_shmControl->ropcode =
-        (RemotePluginOpcode)audioMasterIOChanged;
-    remoteVSTServerInstance->waitForServer(
-        remoteVSTServerInstance->m_shmControl);
+    memcpy(m_shmControl->amptr, &am, sizeof(am));
+    m_shmControl->ropcode = (RemotePluginOpcode)audioMasterIOChanged;
+    waitForServer(m_shmControl);
   }
 
   vst2wrap->resume();
@@ -1039,6 +1246,10 @@ void RemoteVSTServer::EffectOpen(ShmControl *m_shmControlptr) {
 }
 
 RemoteVSTServer::~RemoteVSTServer() {
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   if (effectrun == true) {
     vst2wrap->suspend();
   }
@@ -1050,76 +1261,117 @@ RemoteVSTServer::~RemoteVSTServer() {
     factory->release();
 }
 
+#ifdef PCACHE
+// applies the values the client changed since the last block, only the
+// entries flagged in the dirty map are visited
+void RemoteVSTServer::parFlush() {
+  ParamCache *cache = &m_parcache;
+#ifdef PARBATCH
+  bool applied = false;
+#endif
+
+  if (numpars <= 0)
+    return;
+
+#ifdef STATS
+  m_stats.parblocks.fetch_add(1, std::memory_order_relaxed);
+#endif
+
+  for (int s = 0; s < cache->summarywords; s++) {
+    if (cache->summary[s].load(std::memory_order_relaxed) == 0)
+      continue;
+
+    uint64_t words = cache->summary[s].exchange(0, std::memory_order_acquire);
+#ifdef PARBATCH
+    applied = true;
+#endif
+
+    while (words) {
+      int w = s * 64 + __builtin_ctzll(words);
+      words &= words - 1;
+
+      uint64_t bits = cache->dirty[w].exchange(0, std::memory_order_acquire);
+
+      while (bits) {
+        int idx = w * 64 + __builtin_ctzll(bits);
+        bits &= bits - 1;
+
+#ifdef STATS
+        m_stats.parvisited.fetch_add(1, std::memory_order_relaxed);
+#endif
+        if (idx < numpars) {
+          float value = cache->update[idx];
+          setParameter(idx, value);
+          cache->value[idx] = value;
+#ifdef PDISPLAY
+          pdisplayinval(cache, idx);
+#endif
+        }
+      }
+    }
+  }
+
+#ifdef PARBATCH
+  if (applied)
+    m_shmControl3->displaygen.fetch_add(1, std::memory_order_release);
+#endif
+}
+#endif
+
 void RemoteVSTServer::process(float **inputs, float **outputs,
                               int sampleFrames) {
+#ifdef ASYNCLOAD
+  if (loadEnter()) {
+    vst2wrap->_clearInputEvents();
+    for (int i = 0; i < vst2wrap->numoutputs; i++)
+      memset(outputs[i], 0, sampleFrames * sizeof(float));
+    return;
+  }
+#endif
+
 #ifdef PCACHE
-/*
-  struct alignas(64) ParamState {
-  float value;
-  float valueupdate;
-  char changed;
-  };
-*/
-   
-   ParamState *pstate = (ParamState*)remoteVSTServerInstance->m_shm6; 
-        
-   if(numpars > 0)
-   {
-   for(int idx=0;idx<numpars;idx++)
-   {
-   //sched_yield();
-   if(pstate[idx].changed == 1)
-   {
-   setParameter(idx, pstate[idx].valueupdate);
-   pstate[idx].value = pstate[idx].valueupdate; 
-   pstate[idx].changed = 0; 
-   }    
-   } 
-   }            
+  parFlush();
 #endif
 
   inProcessThread = true;
   vst2wrap->processReplacing(inputs, outputs, sampleFrames);
   inProcessThread = false;
+#ifdef ASYNCLOAD
+  loadinblock.store(0, std::memory_order_release);
+#endif
 }
 
 #ifdef DOUBLEP
 void RemoteVSTServer::processdouble(double **inputs, double **outputs,
                                     int sampleFrames) {
+#ifdef ASYNCLOAD
+  if (loadEnter()) {
+    vst2wrap->_clearInputEvents();
+    for (int i = 0; i < vst2wrap->numoutputs; i++)
+      memset(outputs[i], 0, sampleFrames * sizeof(double));
+    return;
+  }
+#endif
+
 #ifdef PCACHE
-/*
-  struct alignas(64) ParamState {
-  float value;
-  float valueupdate;
-  char changed;
-  };
-*/
-   
-   ParamState *pstate = (ParamState*)remoteVSTServerInstance->m_shm6; 
-        
-   if(numpars > 0)
-   {
-   for(int idx=0;idx<numpars;idx++)
-   {
-   //sched_yield();
-   if(pstate[idx].changed == 1)
-   {
-   setParameter(idx, pstate[idx].valueupdate);
-   pstate[idx].value = pstate[idx].valueupdate; 
-   pstate[idx].changed = 0; 
-   }    
-   } 
-   }            
+  parFlush();
 #endif
 
   inProcessThread = true;
   vst2wrap->processDoubleReplacing(inputs, outputs, sampleFrames);
   inProcessThread = false;
+#ifdef ASYNCLOAD
+  loadinblock.store(0, std::memory_order_release);
+#endif
 }
 
 bool RemoteVSTServer::setPrecision(int value) {
   bool retval;
 
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   retval = vst2wrap->setProcessPrecision(value);
 
   return retval;
@@ -1283,6 +1535,10 @@ int RemoteVSTServer::getEffInt(int opcode, int value) {
    return categnum;
   }
 
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   if (opcode == effMainsChanged) {
     if (value == 0)
       vst2wrap->suspend();
@@ -1314,6 +1570,10 @@ void RemoteVSTServer::effDoVoid(int opcode) {
     return;
   }
 
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   if (opcode == effStartProcess)
     vst2wrap->startProcess();
 
@@ -1363,6 +1623,10 @@ std::string RemoteVSTServer::getEffString(int opcode, int index) {
 }
 
 void RemoteVSTServer::setBufferSize(int sz) {
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   if (bufferSize != sz) {
     vst2wrap->suspend();
     vst2wrap->setBlockSize(sz);
@@ -1372,6 +1636,10 @@ void RemoteVSTServer::setBufferSize(int sz) {
 }
 
 void RemoteVSTServer::setSampleRate(int sr) {
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   if (sampleRate != sr) {
     vst2wrap->suspend();
     vst2wrap->setSampleRate(sr);
@@ -1389,6 +1657,7 @@ void RemoteVSTServer::reset() {
 
 void RemoteVSTServer::terminate() {
   exiting = true;
+  SetEvent(controlWake);
 
   //  cerr << "RemoteVSTServer::terminate: setting exiting flag" << endl;
 }
@@ -1407,6 +1676,13 @@ std::string RemoteVSTServer::getParameterLabel(int p) {
   return name;
 }
 
+#ifdef PMETA
+void RemoteVSTServer::getParameterMeta(int p, ParamMeta *meta) {
+  vst2wrap->getParameterMeta(p, &meta->automate, &meta->steps, &meta->flags,
+                             &meta->defvalue);
+}
+#endif
+
 std::string RemoteVSTServer::getParameterDisplay(int p) {
   char name[512];
   memset(name, 0, sizeof(name));
@@ -1448,8 +1724,15 @@ void RemoteVSTServer::setCurrentProgram(int p) {
   if (debugLevel > 1)
     cerr << "dssi-vst-server[2]: setCurrentProgram(" << p << ")" << endl;
 
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
   if (p < vst2wrap->numprograms)
     vst2wrap->setProgram(p);
+#ifdef PDISPLAY
+  pdisplayinvalall(&m_parcache);
+#endif
 }
 
 bool RemoteVSTServer::warn(std::string warning) {
@@ -1771,6 +2054,10 @@ void RemoteVSTServer::eventloop()
 #endif
 
 void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
+
 #ifdef EMBED
   winm->winerror = 0;
   winm->width = 0;
@@ -1799,7 +2086,7 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
   wclass.hCursor = LoadCursor(0, IDI_APPLICATION);
   // wclass.hbrBackground = (HBRUSH)GetStockObject(BLACK_BRUSH);
   wclass.lpszMenuName = "MENU_DSSI_VST";
-  wclass.lpszClassName = APPLICATION_CLASS_NAME;
+  wclass.lpszClassName = className.c_str();
   wclass.hIconSm = 0;
 
   if (!RegisterClassEx(&wclass)) {
@@ -1818,10 +2105,10 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
 #ifdef EMBED
 #ifdef EMBEDDRAG
   hWnd = CreateWindowEx(WS_EX_TOOLWINDOW | WS_EX_ACCEPTFILES,
-                        APPLICATION_CLASS_NAME, "LinVst", WS_POPUP, 0, 0, 200,
+                        className.c_str(), "LinVst", WS_POPUP, 0, 0, 200,
                         200, 0, 0, GetModuleHandle(0), 0);
 #else
-  hWnd = CreateWindowEx(WS_EX_TOOLWINDOW, APPLICATION_CLASS_NAME, "LinVst",
+  hWnd = CreateWindowEx(WS_EX_TOOLWINDOW, className.c_str(), "LinVst",
                         WS_POPUP, 0, 0, 200, 200, 0, 0, GetModuleHandle(0), 0);
 #endif
   if (!hWnd) {
@@ -1831,7 +2118,7 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
     winm->width = 0;
     winm->height = 0;
     winm->winerror = 1;
-    UnregisterClassA(APPLICATION_CLASS_NAME, GetModuleHandle(0));
+    UnregisterClassA(className.c_str(), GetModuleHandle(0));
     memcpy(m_shmControlptr->wret, winm, sizeof(winmessage));
     return;
   }
@@ -1853,7 +2140,7 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
     winm->height = 0;         
     if (hWnd)
     DestroyWindow(hWnd);
-    UnregisterClassA(APPLICATION_CLASS_NAME, GetModuleHandle(0));
+    UnregisterClassA(className.c_str(), GetModuleHandle(0));
     winm->winerror = 1;
     memcpy(m_shmControlptr->wret, winm, sizeof(winmessage));
     return;
@@ -1986,7 +2273,7 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
       winm->height = 0;                  
       if (hWnd)
       DestroyWindow(hWnd);
-      UnregisterClassA(APPLICATION_CLASS_NAME, GetModuleHandle(0));
+      UnregisterClassA(className.c_str(), GetModuleHandle(0));
       winm->winerror = 1;
       memcpy(m_shmControlptr->wret, winm, sizeof(winmessage));
       return;
@@ -2006,19 +2293,19 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
 }
 #else
 #ifdef DRAG
-  hWnd = CreateWindowEx(WS_EX_ACCEPTFILES, APPLICATION_CLASS_NAME, "LinVst",
+  hWnd = CreateWindowEx(WS_EX_ACCEPTFILES, className.c_str(), "LinVst",
                         WS_OVERLAPPEDWINDOW & ~WS_THICKFRAME & ~WS_MAXIMIZEBOX,
                         CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
                         CW_USEDEFAULT, 0, 0, GetModuleHandle(0), 0);
 #else
-  hWnd = CreateWindow(APPLICATION_CLASS_NAME, "LinVst",
+  hWnd = CreateWindow(className.c_str(), "LinVst",
                       WS_OVERLAPPEDWINDOW & ~WS_THICKFRAME & ~WS_MAXIMIZEBOX,
                       CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
                       CW_USEDEFAULT, 0, 0, GetModuleHandle(0), 0);
 #endif
   if (!hWnd) {
     cerr << "dssi-vst-server: ERROR: Failed to create window!\n" << endl;
-    UnregisterClassA(APPLICATION_CLASS_NAME, GetModuleHandle(0));
+    UnregisterClassA(className.c_str(), GetModuleHandle(0));
     return;
   }
 
@@ -2035,7 +2322,7 @@ void RemoteVSTServer::showGUI(ShmControl *m_shmControlptr) {
          << endl;
     if (hWnd)
       DestroyWindow(hWnd);
-    UnregisterClassA(APPLICATION_CLASS_NAME, GetModuleHandle(0));
+    UnregisterClassA(className.c_str(), GetModuleHandle(0));
     return;
   } else {
 #ifdef WINONTOP
@@ -2118,7 +2405,7 @@ void RemoteVSTServer::hideGUI() {
     if (hWnd) {
     KillTimer(hWnd, timerval);
     DestroyWindow(hWnd);
-    UnregisterClassA(APPLICATION_CLASS_NAME, GetModuleHandle(0));
+    UnregisterClassA(className.c_str(), GetModuleHandle(0));
     }
 
   guiVisible = false;
@@ -2150,6 +2437,10 @@ ULONG numfmt;
 int cfdrop;
 DWORD processID;
 DWORD retprocID;
+RemoteVSTServer *remoteVSTServerInstance = instanceForHook(hook);
+
+  if(!remoteVSTServerInstance)
+  return;
 	
   if(remoteVSTServerInstance->guiVisible == false)
   return;	
@@ -2290,6 +2581,7 @@ DWORD retprocID;
   XSetSelectionOwner(remoteVSTServerInstance->display, remoteVSTServerInstance->XdndSelection, remoteVSTServerInstance->drag_win, CurrentTime);
   }
   remoteVSTServerInstance->dodragwin = 1;
+  SetEvent(remoteVSTServerInstance->hDragStart);
   }
   }       
   }
@@ -2381,7 +2673,11 @@ int RemoteVSTServer::processVstEvents() {
 
   for (int i = 0; i < els; i++) {
     VstEvent *bsize = (VstEvent *)&m_shm2[sizeidx];
+#ifdef SYSEX
+    size = evlink(&m_shm2[sizeidx]);
+#else
     size = bsize->byteSize + (2 * sizeof(VstInt32));
+#endif
     evptr->events[i] = bsize;
     sizeidx += size;
   }
@@ -2391,12 +2687,50 @@ int RemoteVSTServer::processVstEvents() {
   return 1;
 }
 
+#ifdef PARAMQUEUE
+void RemoteVSTServer::processParamQueue() {
+  ParamQueue *queue = pqueue(m_shm2);
+  int count = std::min(queue->count, PARQUEUECOUNT);
+
+  for (int i = 0; i < count; i++) {
+    ParamChange *change = &queue->entry[i];
+    vst2wrap->setParameterAt(change->index, change->value, change->offset);
+#ifdef PCACHE
+    if (change->index >= 0 && change->index < m_parcache.count)
+      m_parcache.value[change->index] = change->value;
+#endif
+#ifdef PDISPLAY
+    pdisplayinval(&m_parcache, change->index);
+#endif
+  }
+
+#ifdef PARBATCH
+  if (count > 0)
+    m_shmControl3->displaygen.fetch_add(1, std::memory_order_release);
+#endif
+}
+#endif
+
 void RemoteVSTServer::getChunk(ShmControl *m_shmControlptr) {
+#ifdef ASYNCLOAD
+  loadWait();
+#endif
 #ifdef CHUNKBUF
   int bnk_prg = m_shmControlptr->value;
   int sz = vst2wrap->getChunk((void **)&chunkptr, bnk_prg ? true : false);
 
   if (sz >= CHUNKSIZEMAX) {
+#ifdef CHUNKMAP
+#ifdef SHMCHUNK
+    // the wrapper's state file already holds the chunk
+    int fd = vst2wrap->_getChunkFd();
+    if (fd >= 0) {
+      chunkMapRelease();
+      sprintf(m_shmControlptr->retstr, "/proc/%d/fd/%d", getpid(), fd);
+    } else
+#endif
+      chunkMapWrite(chunkptr, sz, m_shmControlptr->retstr);
+#endif
     m_shmControlptr->retint = sz;
     return;
   } else {
@@ -2416,13 +2750,141 @@ void RemoteVSTServer::getChunk(ShmControl *m_shmControlptr) {
 #endif
 }
 
+#ifdef ASYNCLOAD
+DWORD WINAPI LoadThreadMain(LPVOID parameter) {
+  RemoteVSTServer *remoteVSTServerInstance = (RemoteVSTServer *)parameter;
+
+  remoteVSTServerInstance->loadRun();
+  ExitThread(0);
+  return 0;
+}
+
+// A state load runs on a thread of its own so the control channel is
+// served meanwhile, the client returns to the host once it has started.
+// The chunk data is taken over by the load.
+bool RemoteVSTServer::loadStart(ShmControl *m_shmControlptr) {
+  int sz = m_shmControlptr->value;
+  char *data;
+  size_t mapsize = 0;
+
+  loadWait();
+
+  if (sz <= 0)
+    return false;
+
+#ifdef CHUNKBUF
+  if (sz >= CHUNKSIZEMAX) {
+    data = chunkptr2;
+#ifdef CHUNKMAP
+    mapsize = chunkmapsize;
+    chunkmapsize = 0;
+#endif
+  } else
+#endif
+  {
+    // the control segment is reused by the next request
+    data = (char *)malloc(sz);
+    if (!data)
+      return false;
+    memcpy(data, m_shm3, sz);
+  }
+
+  if (!data)
+    return false;
+
+  loadptr = data;
+  loadsz = sz;
+  loadbank = m_shmControlptr->value2;
+  loadmapsize = mapsize;
+
+  m_shmControl3->loadstatus.fetch_add(1, std::memory_order_release);
+  loadstate.store(1, std::memory_order_seq_cst);
+
+  hLoadThread = CreateThread(0, 0, LoadThreadMain, this, 0, 0);
+  if (!hLoadThread)
+    loadRun();
+
+  m_shmControlptr->retint = 0;
+  return true;
+}
+
+// the audio thread leaves the plugin alone from the next block on, the
+// load waits for the block it may be in
+void RemoteVSTServer::loadRun() {
+  while (loadinblock.load(std::memory_order_seq_cst))
+    Sleep(1);
+
+  vst2wrap->setChunk(loadptr, loadsz, loadbank ? true : false);
+
+  if (loadmapsize)
+    munmap(loadptr, loadmapsize);
+  else
+    free(loadptr);
+  loadptr = 0;
+
+#ifdef PCACHE
+  parRefresh();
+#endif
+
+  loadstate.store(0, std::memory_order_release);
+  m_shmControl3->loadstatus.fetch_add(1, std::memory_order_release);
+}
+
+void RemoteVSTServer::loadWait() {
+  if (!hLoadThread)
+    return;
+
+  WaitForSingleObject(hLoadThread, INFINITE);
+  CloseHandle(hLoadThread);
+  hLoadThread = 0;
+}
+
+#ifdef PCACHE
+// reads back the values the load applied, values the host set meanwhile
+// keep their dirty bits and go to the plugin on the first block after it
+void RemoteVSTServer::parRefresh() {
+  numpars = std::min(vst2wrap->numparams, m_parcache.count);
+
+  for (int i = 0; i < numpars; ++i)
+    m_parcache.value[i] = getParameter(i);
+
+#ifdef PDISPLAY
+  pdisplayinvalall(&m_parcache);
+#endif
+}
+#endif
+
+// true while a load runs, the block is then left silent
+bool RemoteVSTServer::loadEnter() {
+  loadinblock.store(1, std::memory_order_seq_cst);
+
+  if (loadstate.load(std::memory_order_seq_cst)) {
+    loadinblock.store(0, std::memory_order_release);
+    return true;
+  }
+
+  return false;
+}
+#endif
+
 void RemoteVSTServer::setChunk(ShmControl *m_shmControlptr) {
+#ifdef ASYNCLOAD
+  if (loadStart(m_shmControlptr))
+    return;
+#endif
+
 #ifdef CHUNKBUF
   int sz = m_shmControlptr->value;
   if (sz >= CHUNKSIZEMAX) {
     int bnk_prg = m_shmControlptr->value2;
     void *ptr = chunkptr2;
     int r = vst2wrap->setChunk(ptr, sz, bnk_prg ? true : false);
+#ifdef CHUNKMAP
+    if (chunkmapsize) {
+      munmap(chunkptr2, chunkmapsize);
+      chunkmapsize = 0;
+    } else
+#endif
     free(chunkptr2);
     m_shmControlptr->retint = r;
 #ifdef PCACHE
@@ -2477,16 +2939,12 @@ void RemoteVSTServer::waitForServerexit() {
   fpost(m_shmControl, &m_shmControl->runClient);
 }
 
-#ifdef VESTIGE
-VstIntPtr VESTIGECALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
-                                       VstInt32 index, VstIntPtr value,
-                                       void *ptr, float opt)
-#else
-VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
-                                   VstInt32 index, VstIntPtr value, void *ptr,
-                                   float opt)
-#endif
-{
+// remoteVSTServerInstance is the instance the plugin belongs to, the
+// global one in single instance mode
+VstIntPtr hostCallbackInstance(RemoteVSTServer *remoteVSTServerInstance,
+                               AEffect *plugin, VstInt32 opcode,
+                               VstInt32 index, VstIntPtr value, void *ptr,
+                               float opt) {
   VstIntPtr rv = 0;
   int retval = 0;
 
@@ -2520,12 +2978,17 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
   case audioMasterAutomate:
     //     plugin->setParameter(plugin, index, opt);
     if (remoteVSTServerInstance) {
+#ifdef PDISPLAY
+      pdisplayinval(&remoteVSTServerInstance->m_parcache, index);
+#endif
       if (!remoteVSTServerInstance->exiting &&
           remoteVSTServerInstance->effectrun) {
-#ifdef PCACHE	
-	if(index >= 10000)
-	break;	
-#endif	      	      
+#ifdef AMRING
+        if (remoteVSTServerInstance->amPush(opcode, index, opt)) {
+          remoteVSTServerInstance->amNotify();
+          break;
+        }
+#endif
         remoteVSTServerInstance->m_shmControlptr->ropcode =
             (RemotePluginOpcode)opcode;
         remoteVSTServerInstance->m_shmControlptr->value = index;
@@ -2566,6 +3029,12 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
     if (remoteVSTServerInstance) {
       if (!remoteVSTServerInstance->exiting &&
           remoteVSTServerInstance->effectrun) {
+#ifdef AMRING
+        if (remoteVSTServerInstance->amPush(opcode, index, 0)) {
+          remoteVSTServerInstance->amNotify();
+          break;
+        }
+#endif
         remoteVSTServerInstance->m_shmControlptr->ropcode =
             (RemotePluginOpcode)opcode;
         remoteVSTServerInstance->m_shmControlptr->value = index;
@@ -2585,6 +3054,12 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
     if (remoteVSTServerInstance) {
       if (!remoteVSTServerInstance->exiting &&
           remoteVSTServerInstance->effectrun) {
+#ifdef AMRING
+        if (remoteVSTServerInstance->amPush(opcode, index, 0)) {
+          remoteVSTServerInstance->amNotify();
+          break;
+        }
+#endif
         remoteVSTServerInstance->m_shmControlptr->ropcode =
             (RemotePluginOpcode)opcode;
         remoteVSTServerInstance->m_shmControlptr->value = index;
@@ -2669,6 +3144,19 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
           break;
         }
 
+#ifdef OUTEVENTS
+        if (remoteVSTServerInstance->inProcessThread &&
+            remoteVSTServerInstance->outEventsPush(evnts))
+          break;
+#endif
+
+#ifdef AMRING
+        if (remoteVSTServerInstance->amPushEvents(evnts)) {
+          remoteVSTServerInstance->amNotify();
+          break;
+        }
+#endif
+
         eventnum = evnts->numEvents;
         eventnum2 = 0;  
 
@@ -2681,9 +3169,16 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
 
         for (int i = 0; i < eventnum; i++) {
           VstEvent *pEvent = evnts->events[i];
-          if (pEvent->type == kVstSysExType)
+          if (pEvent->type == kVstSysExType) {
+#ifdef SYSEX
+            if (sizeidx + evpackedsize(pEvent) > VSTEVENTS_SEND)
+              continue;
+            sizeidx += evpack(&remoteVSTServerInstance->m_shm4[sizeidx],
+                              pEvent);
+            eventnum2++;
+#endif
           continue;
-          else {
+          } else {
             unsigned int size =
                 (2 * sizeof(VstInt32)) + evnts->events[i]->byteSize;
             memcpy(&remoteVSTServerInstance->m_shm4[sizeidx], evnts->events[i], size);
@@ -2741,6 +3236,10 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
         if (am.delay != remoteVSTServerInstance->m_delay)
           remoteVSTServerInstance->m_delay = am.delay;
 
+        remoteVSTServerInstance->lockShm(
+            std::max(am.incount, remoteVSTServerInstance->m_numInputs),
+            std::max(am.outcount, remoteVSTServerInstance->m_numOutputs), -1);
+
         memcpy(remoteVSTServerInstance->m_shmControlptr->amptr, &am,
                sizeof(am));
 
@@ -2779,6 +3278,16 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
   } break;
 
   case audioMasterUpdateDisplay:
+#ifdef PDISPLAY
+    if (remoteVSTServerInstance)
+      pdisplayinvalall(&remoteVSTServerInstance->m_parcache);
+#endif
+#ifdef PMETA
+    if (remoteVSTServerInstance &&
+        (value & Steinberg::Vst::kParamTitlesChanged))
+      remoteVSTServerInstance->parMetaBuild(
+          remoteVSTServerInstance->vst2wrap->numparams);
+#endif
     /*
            if (debugLevel > 1)
                cerr << "dssi-vst-server[2]: audioMasterUpdateDisplay requested"
@@ -3210,9 +3719,49 @@ VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
   return rv;
 }
 
-void RemoteVSTServer::finisherror() {
-  cerr << "Failed to create par thread!" << endl;
-
+#ifdef VESTIGE
+VstIntPtr VESTIGECALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
+                                       VstInt32 index, VstIntPtr value,
+                                       void *ptr, float opt)
+#else
+VstIntPtr VSTCALLBACK hostCallback(AEffect *plugin, VstInt32 opcode,
+                                   VstInt32 index, VstIntPtr value, void *ptr,
+                                   float opt)
+#endif
+{
+  return hostCallbackInstance(remoteVSTServerInstance, plugin, opcode, index,
+                              value, ptr, opt);
+}
+
+#ifdef MULTISERVER
+// The wrapper calls audioMaster with a NULL or temporary AEffect, so the
+// instance can't be found from the plugin pointer. Each instance gets its own
+// callback instead, one template instantiation per slot.
+template <int N>
+#ifdef VESTIGE
+VstIntPtr VESTIGECALLBACK
+#else
+VstIntPtr VSTCALLBACK
+#endif
+hostCallbackSlot(AEffect *plugin, VstInt32 opcode, VstInt32 index,
+                 VstIntPtr value, void *ptr, float opt) {
+  return hostCallbackInstance(remoteVSTServerSlots[N], plugin, opcode, index,
+                              value, ptr, opt);
+}
+
+template <int... N>
+std::array<audioMasterCallback, sizeof...(N)>
+hostCallbackTable(std::integer_sequence<int, N...>) {
+  return {{hostCallbackSlot<N>...}};
+}
+
+const std::array<audioMasterCallback, MULTISLOTS> hostCallbackSlots =
+    hostCallbackTable(std::make_integer_sequence<int, MULTISLOTS>());
+#endif
+
+void RemoteVSTServer::finisherror() {
+  cerr << "Failed to create par thread!" << endl;
+
   exiting = 1;
   sleep(1);
 
@@ -3222,11 +3771,15 @@ void RemoteVSTServer::finisherror() {
     CloseHandle(ThreadHandle[0]);
   }
 #ifdef DRAGWIN 
+  if (hDragStart)
+    SetEvent(hDragStart);
   if (ThreadHandle[1]) {
     WaitForSingleObject(ThreadHandle[1], 5000);
     // TerminateThread(ThreadHandle[1], 0);
     CloseHandle(ThreadHandle[1]);
   }
+  if (hDragStart)
+    CloseHandle(hDragStart);
 #endif
 #ifndef PCACHE
   if (ThreadHandle[2]) {
@@ -3243,7 +3796,7 @@ void RemoteVSTServer::finisherror() {
 
   if (m_shmControl) {
     m_shmControl->ropcode = (RemotePluginOpcode)disconnectserver;
-    waitForServer(remoteVSTServerInstance->m_shmControl);
+    waitForServer(m_shmControl);
     waitForClient2exit();
     waitForClient3exit();
     waitForClient4exit();
@@ -3493,261 +4046,256 @@ createEffectInstance2(audioMasterCallback audioMaster, HMODULE libHandle,
   return Steinberg::Vst::Vst2Wrapper::create(factory, cid, idval, audioMaster);
 }
 
-int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, LPSTR cmdline,
-                   int cmdshow) {
-  //  HANDLE  remoteVSTServerInstance->ThreadHandle[3] = {0,0,0};
-  string pathName;
-  string fileName;
-  char cdpath[4096];
-  char *libname = 0;
-  char *libname2 = 0;
-  char *fileInfo = 0;
-  string libnamepath;
-  string partidx;
-  char *outname[10];
-  int offset = 0;
-  int idx = 0;
-  int ci = 0;
-  int *ptr;
-    
-  HMODULE libHandle = 0;
+#ifdef MULTISERVER
+struct ModuleRef {
+  std::string path;
+  HMODULE libHandle;
+  int refs;
+};
 
-  cerr << "DSSI VST plugin server v" << RemotePluginVersion << endl;
-  cerr << "Copyright (c) 2012-2013 Filipe Coelho" << endl;
-  cerr << "Copyright (c) 2010-2011 Kristian Amlie" << endl;
-  cerr << "Copyright (c) 2004-2006 Chris Cannam" << endl;
-  cerr << "LinVst3 version 4.9" << endl;
+// a dll shared by several instances is loaded and initialised once. Loads
+// run on the instance load threads, an entry without a handle is a dll
+// another thread is loading, moduleLoaded is signalled when that is done.
+std::vector<ModuleRef> moduleRefs;
+std::mutex moduleLock;
+std::condition_variable moduleLoaded;
 
-  /*
+HMODULE loadModuleOnce(std::string libname);
 
-  if (cmdline)
-  {
-  int offset = 0;
-  if (cmdline[0] == '"' || cmdline[0] == '\'') offset = 1;
-  for (int ci = offset; cmdline[ci]; ++ci)
-  {
-  if (cmdline[ci] == ',')
-  {
-  libname2 = strndup(cmdline + offset, ci - offset);
-  ++ci;
-  if (cmdline[ci])
-  {
-  fileInfo = strdup(cmdline + ci);
-  int l = strlen(fileInfo);
-  if (fileInfo[l-1] == '"' || fileInfo[l-1] == '\'')
-  fileInfo[l-1] = '\0';
-  }
-  }
-  }
-  }
-  */
+HMODULE loadModule(std::string libname) {
+  std::unique_lock<std::mutex> lock(moduleLock);
 
-  if (cmdline[0] == '\0') {
-    exit(0);
-    // return 1;
+  for (;;) {
+    auto module = std::find_if(
+        moduleRefs.begin(), moduleRefs.end(),
+        [&](const ModuleRef &ref) { return ref.path == libname; });
+
+    if (module == moduleRefs.end())
+      break;
+
+    if (module->libHandle) {
+      module->refs++;
+      return module->libHandle;
+    }
+    moduleLoaded.wait(lock);
   }
 
-  if (cmdline) {
-    if (cmdline[0] == '"' || cmdline[0] == '\'')
-      offset = 1;
-    for (ci = offset; cmdline[ci]; ++ci) {
-      if (cmdline[ci] == ',') {
-        outname[idx] = strndup(cmdline + offset, ci - offset);
-        ++idx;
-        ++ci;
-        offset = ci;
-      }
+  moduleRefs.push_back({libname, 0, 1});
+  lock.unlock();
+
+  HMODULE libHandle = loadModuleOnce(libname);
+
+  lock.lock();
+  for (size_t i = 0; i < moduleRefs.size(); i++) {
+    if ((moduleRefs[i].path == libname) && !moduleRefs[i].libHandle) {
+      if (libHandle)
+        moduleRefs[i].libHandle = libHandle;
+      else
+        moduleRefs.erase(moduleRefs.begin() + i);
+      break;
     }
-    outname[idx] = strndup(cmdline + offset, ci - offset);
   }
+  moduleLoaded.notify_all();
 
-  partidx = outname[0];
-  libname2 = outname[1];
-  fileInfo = outname[2];
-  int l = strlen(fileInfo);
-  if (fileInfo[l - 1] == '"' || fileInfo[l - 1] == '\'')
-    fileInfo[l - 1] = '\0';
+  return libHandle;
+}
 
-  // printf("fileinfo %s\n", fileInfo);
+HMODULE loadModuleOnce(std::string libname) {
+#else
+HMODULE loadModule(std::string libname) {
+#endif
+  cerr << "Loading  " << libname << endl;
 
-  if (libname2 != NULL) {
-    if ((libname2[0] == '/') && (libname2[1] == '/'))
-      libname = strdup(&libname2[1]);
-    else
-      libname = strdup(libname2);
-  } else {
-    cerr << "Usage: dssi-vst-server <vstname.dll>,<tmpfilebase>" << endl;
-    cerr << "(Command line was: " << cmdline << ")" << endl;
+  HMODULE libHandle = ::LoadLibraryA(libname.c_str());
+  if (!libHandle) {
+    cerr << "dssi-vst-server: ERROR: Couldn't load VST DLL \"" << libname
+         << "\"" << endl;
+    return 0;
+  }
 
-    exit(0);
-    // return 1;
+  InitModuleProc initProc =
+      (InitModuleProc)::GetProcAddress((HMODULE)libHandle, kInitModuleProcName);
+  if (initProc) {
+    if (initProc() == false) {
+      cerr << "initprocerr" << endl;
+      ExitModuleProc exitProc = (ExitModuleProc)::GetProcAddress(
+          (HMODULE)libHandle, kExitModuleProcName);
+      if (exitProc)
+        exitProc();
+      FreeLibrary(libHandle);
+      return 0;
+    }
   }
 
-  if (!libname || !libname[0] || !fileInfo || !fileInfo[0]) {
-    cerr << "Usage: dssi-vst-server <vstname.dll>,<tmpfilebase>" << endl;
-    cerr << "(Command line was: " << cmdline << ")" << endl;
+  return libHandle;
+}
 
-    exit(0);
-    // return 1;
-  }
+void freeModule(HMODULE libHandle) {
+  if (!libHandle)
+    return;
 
-  strcpy(cdpath, libname);
-  pathName = cdpath;
-  fileName = cdpath;
-  size_t found = pathName.find_last_of("/");
-  pathName = pathName.substr(0, found);
-  size_t found2 = fileName.find_last_of("/");
-  fileName = fileName.substr(found2 + 1, strlen(libname) - (found2 + 1));
-  // SetCurrentDirectory(pathName.c_str());
-    
-  libnamepath = " ";    
-    
-  libnamepath = libname;    
-/*
-   struct sched_param param;
-   param.sched_priority = 0;
-   (void)sched_setscheduler(0, SCHED_OTHER, &param);
-*/
+#ifdef MULTISERVER
+  // held over the exit too, so a load of the same dll waits for it
+  std::lock_guard<std::mutex> lock(moduleLock);
 
-  SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_SYSTEM_AWARE);
+  for (size_t i = 0; i < moduleRefs.size(); i++) {
+    if (moduleRefs[i].libHandle == libHandle) {
+      if (--moduleRefs[i].refs > 0)
+        return;
+      moduleRefs.erase(moduleRefs.begin() + i);
+      break;
+    }
+  }
+#endif
 
-  HRESULT oleret = OleInitialize(NULL);
-	
-  remoteVSTServerInstance = 0;
+  ExitModuleProc exitProc = (ExitModuleProc)::GetProcAddress(
+      (HMODULE)libHandle, kExitModuleProcName);
+  if (exitProc)
+    exitProc();
+  FreeLibrary(libHandle);
+}
 
+// connects to the client and loads the dll, returns 0 if either fails. In a
+// MULTISERVER process this runs on the load thread of the instance.
+RemoteVSTServer *loadInstance(string libname, string fileInfo) {
+  string fileName = libname.substr(libname.find_last_of("/") + 1);
   string deviceName = fileName;
   size_t foundext = deviceName.find_last_of(".");
   deviceName = deviceName.substr(0, foundext);
-  remoteVSTServerInstance = new RemoteVSTServer(fileInfo, deviceName);
+
+  RemoteVSTServer *remoteVSTServerInstance =
+      new RemoteVSTServer(fileInfo, deviceName);
 
   if (!remoteVSTServerInstance) {
     cerr << "ERROR: Remote VST startup failed" << endl;
     usleep(5000000);
-    exit(0);
+    return 0;
   }
 
   if (remoteVSTServerInstance->starterror == 1) {
     cerr << "ERROR: Remote VST startup error" << endl;
-    if (remoteVSTServerInstance) {
-      if(remoteVSTServerInstance->m_shm)
-      {
-      ptr = (int *)remoteVSTServerInstance->m_shm;  
-      *ptr = 2001;
-      }
-      remoteVSTServerInstance->finisherror();
-      delete remoteVSTServerInstance;
+    if (remoteVSTServerInstance->m_shm) {
+      int *ptr = (int *)remoteVSTServerInstance->m_shm;
+      fstartset(ptr, StartupServerError);
     }
-    exit(0);
+    remoteVSTServerInstance->finisherror();
+    delete remoteVSTServerInstance;
+    return 0;
   }
-  
-  ptr = (int *)remoteVSTServerInstance->m_shm;   
+
+  int *ptr = (int *)remoteVSTServerInstance->m_shm;
 
   remoteVSTServerInstance->ThreadHandle[0] = 0;
   remoteVSTServerInstance->ThreadHandle[1] = 0;
   remoteVSTServerInstance->ThreadHandle[2] = 0;
-  remoteVSTServerInstance->ThreadHandle[3] = 0;  
-  
-  cerr << "Loading  " << libname << endl;
+  remoteVSTServerInstance->ThreadHandle[3] = 0;
 
-  libHandle = ::LoadLibraryA(libname);
+  HMODULE libHandle = loadModule(libname);
   if (!libHandle) {
-    cerr << "dssi-vst-server: ERROR: Couldn't load VST DLL \"" << libname
-         << "\"" << endl;
-    *ptr = 2001;     
+    fstartset(ptr, StartupServerError);
     remoteVSTServerInstance->finisherror();
     delete remoteVSTServerInstance;
-    exit(0);
+    return 0;
   }
-  
-  InitModuleProc initProc =
-      (InitModuleProc)::GetProcAddress((HMODULE)libHandle, kInitModuleProcName);
-  if (initProc) {
-    if (initProc() == false) {
-      cerr << "initprocerr" << endl;
-      *ptr = 2001;  
-      remoteVSTServerInstance->finisherror();
-      delete remoteVSTServerInstance;
-
-      if (libHandle) {
-        ExitModuleProc exitProc = (ExitModuleProc)::GetProcAddress(
-            (HMODULE)libHandle, kExitModuleProcName);
-        if (exitProc)
-          exitProc();
-        FreeLibrary(libHandle);
-      }
-      exit(0);
-      // return 1;
-    }
-  }  
-  
+  remoteVSTServerInstance->libHandle = libHandle;
+
   DWORD threadIdp = 0;
   remoteVSTServerInstance->ThreadHandle[0] =
-      CreateThread(0, 0, AudioThreadMain, 0, CREATE_SUSPENDED, &threadIdp);
+      CreateThread(0, 0, AudioThreadMain, remoteVSTServerInstance, CREATE_SUSPENDED, &threadIdp);
 
 #ifdef DRAGWIN 
   DWORD threadIdp2 = 0;
+  remoteVSTServerInstance->hDragStart = CreateEvent(0, FALSE, FALSE, 0);
   remoteVSTServerInstance->ThreadHandle[1] =
-      CreateThread(0, 0, GetSetThreadMain, 0, CREATE_SUSPENDED, &threadIdp2);
+      CreateThread(0, 0, GetSetThreadMain, remoteVSTServerInstance, CREATE_SUSPENDED, &threadIdp2);
 #endif
 
+  int threadsok = 1;
+
+#ifdef FUTEXWAITV
+  // one dispatcher thread for the non audio channels if the kernel allows it
+  if (fwaitvcheck()) {
+    DWORD threadIdp6 = 0;
+    remoteVSTServerInstance->dispatchv = 1;
+    remoteVSTServerInstance->ThreadHandle[3] =
+        CreateThread(0, 0, DispatchThreadMain, remoteVSTServerInstance, CREATE_SUSPENDED, &threadIdp6);
+    if (!remoteVSTServerInstance->ThreadHandle[3])
+      threadsok = 0;
+  } else
+#endif
+  {
 #ifndef PCACHE
   DWORD threadIdp3 = 0;
   remoteVSTServerInstance->ThreadHandle[2] =
-      CreateThread(0, 0, ParThreadMain, 0, CREATE_SUSPENDED, &threadIdp3);
+      CreateThread(0, 0, ParThreadMain, remoteVSTServerInstance, CREATE_SUSPENDED, &threadIdp3);
 #endif
   
   DWORD threadIdp4 = 0;
   remoteVSTServerInstance->ThreadHandle[3] =
-      CreateThread(0, 0, ControlThreadMain, 0, CREATE_SUSPENDED, &threadIdp4);
+      CreateThread(0, 0, ControlThreadMain, remoteVSTServerInstance, CREATE_SUSPENDED, &threadIdp4);
+
+  DWORD threadIdp5 = 0;
+  remoteVSTServerInstance->hControlDone = CreateEvent(0, FALSE, FALSE, 0);
+  remoteVSTServerInstance->hControlWatch =
+      CreateThread(0, 0, ControlWatchMain, remoteVSTServerInstance, CREATE_SUSPENDED, &threadIdp5);
+
+  if (
+#ifndef PCACHE
+     !remoteVSTServerInstance->ThreadHandle[2] ||
+#endif
+     !remoteVSTServerInstance->ThreadHandle[3]
+    || !remoteVSTServerInstance->hControlDone
+    || !remoteVSTServerInstance->hControlWatch)
+    threadsok = 0;
+  }
       
   if (!remoteVSTServerInstance->ThreadHandle[0]
 #ifdef DRAGWIN 
  || !remoteVSTServerInstance->ThreadHandle[1]
+ || !remoteVSTServerInstance->hDragStart
 #endif
-#ifndef PCACHE
-     || !remoteVSTServerInstance->ThreadHandle[2] 
-#endif
-    || !remoteVSTServerInstance->ThreadHandle[3]) {
+    || !threadsok) {
     cerr << "Failed to create par thread!" << endl;
-    *ptr = 2001;
+    fstartset(ptr, StartupServerError);
     remoteVSTServerInstance->finisherror();
     delete remoteVSTServerInstance;
-    exit(0);
+    freeModule(libHandle);
+    return 0;
   }  
   
-  *ptr = 2000;
-
-  int startok;
-
-  startok = 0;
-
-  for (int i = 0; i < 400000; i++) {
-    if (*ptr == 6000) {
-      startok = 1;
-      break;
-    }
-    usleep(100);
-  }
+  fstartset(ptr, StartupServerReady);
 
-  if (startok == 0) {
+  if (fstartwait(ptr, StartupServerReady, STARTUPTIMEOUT) != StartupClientAck) {
     cerr << "Failed to connect" << endl;
     remoteVSTServerInstance->finisherror();
     delete remoteVSTServerInstance;
-
-    if (libHandle) {
-      ExitModuleProc exitProc = (ExitModuleProc)::GetProcAddress(
-          (HMODULE)libHandle, kExitModuleProcName);
-      if (exitProc)
-        exitProc();
-      FreeLibrary(libHandle);
-    }
-    exit(0);
+    freeModule(libHandle);
+    return 0;
   }
 
+  remoteVSTServerInstance->deviceName2 = deviceName;
+
+  return remoteVSTServerInstance;
+}
+
+// creates the plugin, starts the instance threads and opens the display of a
+// loaded instance, on the main thread. Cleans up and returns false if the
+// plugin cannot be created.
+bool createInstance(RemoteVSTServer *remoteVSTServerInstance, string partidx,
+                    string libname, int slot) {
+  HMODULE libHandle = remoteVSTServerInstance->libHandle;
+
   audioMasterCallback hostCallbackFuncPtr = hostCallback;
+#ifdef MULTISERVER
+  remoteVSTServerInstance->slot = slot;
+  remoteVSTServerSlots[slot] = remoteVSTServerInstance;
+  hostCallbackFuncPtr = hostCallbackSlots[slot];
+#else
+  ::remoteVSTServerInstance = remoteVSTServerInstance;
+#endif
 
   remoteVSTServerInstance->vst2wrap = createEffectInstance2(
-      hostCallbackFuncPtr, libHandle, libnamepath, partidx,
+      hostCallbackFuncPtr, libHandle, libname, partidx,
       remoteVSTServerInstance->factory, &remoteVSTServerInstance->vst2uid);
 
   if (!remoteVSTServerInstance->vst2wrap) {
@@ -3756,16 +4304,11 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, LPSTR cmdline,
 
     remoteVSTServerInstance->finisherror();
     delete remoteVSTServerInstance;
-
-    if (libHandle) {
-      ExitModuleProc exitProc = (ExitModuleProc)::GetProcAddress(
-          (HMODULE)libHandle, kExitModuleProcName);
-      if (exitProc)
-        exitProc();
-      FreeLibrary(libHandle);
-    }
-    exit(0);
-    // return 1;
+#ifdef MULTISERVER
+    remoteVSTServerSlots[slot] = 0;
+#endif
+    freeModule(libHandle);
+    return false;
   }
 
   if (remoteVSTServerInstance->vst2wrap->editor) {
@@ -3779,12 +4322,13 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, LPSTR cmdline,
   ResumeThread(remoteVSTServerInstance->ThreadHandle[1]);
 #endif
 #ifndef PCACHE
+  if (remoteVSTServerInstance->ThreadHandle[2])
   ResumeThread(remoteVSTServerInstance->ThreadHandle[2]);
 #endif
   ResumeThread(remoteVSTServerInstance->ThreadHandle[3]);  
+  if (remoteVSTServerInstance->hControlWatch)
+  ResumeThread(remoteVSTServerInstance->hControlWatch);
 
-  remoteVSTServerInstance->deviceName2 = deviceName;
-  
    if(XInitThreads() == 0)
    {
    remoteVSTServerInstance->haveGui = false;    
@@ -3847,78 +4391,40 @@ else
   }
 #endif     
 
-  MSG msg;
-  int tcount = 0;
+  return true;
+}
 
-  while (!remoteVSTServerInstance->exiting) {
-    if (remoteVSTServerInstance->wavesthread == 1) {
-      for (int loopidx = 0;
-           (loopidx < 10) && PeekMessage(&msg, 0, 0, 0, PM_REMOVE); loopidx++) {
-        if (remoteVSTServerInstance->exiting)
-          break;
-          
-        if((msg.message == WM_TIMER) && (msg.wParam == 678))
-        {
-        if((remoteVSTServerInstance->guiVisible == true) && (remoteVSTServerInstance->hostreaper == 1) && (remoteVSTServerInstance->pparent == 0) && (remoteVSTServerInstance->reaptimecount < 100))
-        remoteVSTServerInstance->guiUpdate();
-        }          
+// connects to the client, loads the dll and creates the plugin, returns 0
+// if any of that fails
+RemoteVSTServer *startInstance(string partidx, string libname,
+                               string fileInfo, int slot) {
+  if (libname.compare(0, 2, "//") == 0)
+    libname.erase(0, 1);
 
-        if (msg.message == 15 && !remoteVSTServerInstance->guiVisible)
-          break;
+  RemoteVSTServer *remoteVSTServerInstance = loadInstance(libname, fileInfo);
 
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+  if (!remoteVSTServerInstance ||
+      !createInstance(remoteVSTServerInstance, partidx, libname, slot))
+    return 0;
 
-        //if (remoteVSTServerInstance->hidegui == 1)
-        // break;
-        }
+  return remoteVSTServerInstance;
+}
 
-      //if (remoteVSTServerInstance->hidegui == 1) {
-      //  remoteVSTServerInstance->hideGUI();
-      //}
+// waits for the threads of an exiting instance, in a MULTISERVER process on
+// the stop thread of the instance
+void stopInstance(RemoteVSTServer *remoteVSTServerInstance) {
+  controlServed(remoteVSTServerInstance);
+  remoteVSTServerInstance->waitForServerexit();
+  remoteVSTServerInstance->waitForClient2exit();
+  remoteVSTServerInstance->waitForClient3exit();
+  remoteVSTServerInstance->waitForClient4exit();
+  remoteVSTServerInstance->waitForClient5exit();
+  remoteVSTServerInstance->waitForClient6exit();
+#ifdef DRAGWIN
+  SetEvent(remoteVSTServerInstance->hDragStart);
+#endif
 
-      if (remoteVSTServerInstance->exiting)
-        break;
-      remoteVSTServerInstance->dispatchControl(5);
-    } else {
-      while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
-        if (remoteVSTServerInstance->exiting)
-          break;
-          
-        if((msg.message == WM_TIMER) && (msg.wParam == 678))
-        {
-        if((remoteVSTServerInstance->guiVisible == true) && (remoteVSTServerInstance->hostreaper == 1) && (remoteVSTServerInstance->pparent == 0) && (remoteVSTServerInstance->reaptimecount < 100))
-        remoteVSTServerInstance->guiUpdate();
-        }          
-
-        if (msg.message == 15 && !remoteVSTServerInstance->guiVisible)
-          break;
-
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-
-        //if (remoteVSTServerInstance->hidegui == 1)
-        // break;
-      }
-
-      //if (remoteVSTServerInstance->hidegui == 1) {
-      //  remoteVSTServerInstance->hideGUI();
-      //}
-
-      if (remoteVSTServerInstance->exiting)
-        break;
-      remoteVSTServerInstance->dispatchControl(5);
-    }
-  }
-
-  remoteVSTServerInstance->waitForServerexit();
-  remoteVSTServerInstance->waitForClient2exit();
-  remoteVSTServerInstance->waitForClient3exit();
-  remoteVSTServerInstance->waitForClient4exit();
-  remoteVSTServerInstance->waitForClient5exit();
-  remoteVSTServerInstance->waitForClient6exit();
-
- // WaitForMultipleObjects(4, remoteVSTServerInstance->ThreadHandle, TRUE, 5000);
+ // WaitForMultipleObjects(4, remoteVSTServerInstance->ThreadHandle, TRUE, 5000);
 
   for (int idx50 = 0; idx50 < 100000; idx50++) {
     if (
@@ -3929,7 +4435,7 @@ remoteVSTServerInstance->audfin &&
 #ifdef DRAGWIN 
         remoteVSTServerInstance->getfin && 
 #endif
-remoteVSTServerInstance->confin)
+remoteVSTServerInstance->confin && remoteVSTServerInstance->watchfin)
       break;
     usleep(100);
   }
@@ -3961,9 +4467,22 @@ remoteVSTServerInstance->confin)
     CloseHandle(remoteVSTServerInstance->ThreadHandle[3]);
   }  
 
+  if (remoteVSTServerInstance->hControlWatch)
+  CloseHandle(remoteVSTServerInstance->hControlWatch);
+  if (remoteVSTServerInstance->hControlDone)
+  CloseHandle(remoteVSTServerInstance->hControlDone);
+#ifdef DRAGWIN
+  if (remoteVSTServerInstance->hDragStart)
+  CloseHandle(remoteVSTServerInstance->hDragStart);
+#endif
+
   if (debugLevel > 0)
     cerr << "dssi-vst-server[1]: closed threads" << endl;
-    
+}
+
+// closes the windows and display of a stopped instance and deletes it, on
+// the main thread
+void releaseInstance(RemoteVSTServer *remoteVSTServerInstance) {
 #ifdef DRAGWIN 
   if(remoteVSTServerInstance->g_hook)
   UnhookWinEvent(remoteVSTServerInstance->g_hook);  
@@ -3977,22 +4496,580 @@ remoteVSTServerInstance->confin)
   if(remoteVSTServerInstance->display)  
     XCloseDisplay(remoteVSTServerInstance->display);
 
-  if (remoteVSTServerInstance)
-    delete remoteVSTServerInstance;
+  HMODULE libHandle = remoteVSTServerInstance->libHandle;
 
-  if (libHandle) {
-    ExitModuleProc exitProc = (ExitModuleProc)::GetProcAddress(
-        (HMODULE)libHandle, kExitModuleProcName);
-    if (exitProc)
-      exitProc();
-    FreeLibrary(libHandle);
+#ifdef MULTISERVER
+  // host callbacks made while the plugin is destroyed find no instance
+  for (int i = 0; i < MULTISLOTS; i++) {
+    if (remoteVSTServerSlots[i] == remoteVSTServerInstance)
+      remoteVSTServerSlots[i] = 0;
   }
+#endif
 
-  if(oleret == S_OK)
-  OleUninitialize();	
+  delete remoteVSTServerInstance;
+
+  freeModule(libHandle);
 
   if (debugLevel > 0)
     cerr << "dssi-vst-server[1]: freed dll" << endl;
+}
+
+void finishInstance(RemoteVSTServer *remoteVSTServerInstance) {
+  stopInstance(remoteVSTServerInstance);
+  releaseInstance(remoteVSTServerInstance);
+}
+
+#if defined(MULTISERVER) || defined(SERVERPOOL)
+// abstract unix socket clients of the same wine prefix attach to
+int listenInstances(const char *sockname) {
+  struct sockaddr_un addr;
+  size_t len = strlen(sockname);
+
+  if ((len == 0) || (len + 1 >= sizeof(addr.sun_path)))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(&addr.sun_path[1], sockname, len);
+
+  if (bind(fd, (struct sockaddr *)&addr,
+           offsetof(struct sockaddr_un, sun_path) + 1 + len) ||
+      listen(fd, 16)) {
+    // another server already has this name
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// an abstract socket has no file permissions, any local user can connect
+bool peerIsUser(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  return (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) &&
+         (cred.uid == getuid());
+}
+
+// a client sends "partidx,dllpath,fileinfo[,...]\n", gets '1' when it can be
+// served and confirms with '1' before the handshake on its shared memory
+// starts, so a client that gave up waiting never gets an instance. Clients
+// of other users are dropped without a reply.
+int acceptRequest(int listenfd, string &line, int canserve) {
+  int fd = accept4(listenfd, 0, 0, SOCK_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (!peerIsUser(fd)) {
+    cerr << "dssi-vst-server: refused a client of another user" << endl;
+    close(fd);
+    return 0;
+  }
+
+  struct pollfd pfd = {fd, POLLIN, 0};
+  char buf[4096];
+  int len = 0;
+
+  while ((len < (int)sizeof(buf) - 1) && (poll(&pfd, 1, 1000) > 0)) {
+    int ret = read(fd, &buf[len], sizeof(buf) - 1 - len);
+    if (ret <= 0)
+      break;
+    len += ret;
+    if (memchr(buf, '\n', len))
+      break;
+  }
+  buf[len] = '\0';
+
+  line = buf;
+  size_t end = line.find('\n');
+  size_t comma1 = line.find(',');
+  size_t comma2 =
+      (comma1 == string::npos) ? string::npos : line.find(',', comma1 + 1);
+
+  char reply = '0';
+  if ((end != string::npos) && (comma2 != string::npos) && (comma2 < end) &&
+      canserve) {
+    reply = '1';
+    line.erase(end);
+  }
+
+  int confirmed = 0;
+  if ((send(fd, &reply, 1, MSG_NOSIGNAL) == 1) && (reply == '1')) {
+    char confirm = 0;
+    if ((poll(&pfd, 1, 5000) > 0) && (read(fd, &confirm, 1) == 1) &&
+        (confirm == '1'))
+      confirmed = 1;
+  }
+  close(fd);
+
+  return confirmed;
+}
+#endif
+
+// dispatches a waiting control request, otherwise sleeps until the next one
+// or a window message, paintwait keeps polling while a hidden window still
+// has a paint pending
+void serveControl(RemoteVSTServer *remoteVSTServerInstance, int paintwait) {
+  if (remoteVSTServerInstance->m_shmControl3->runServer > 0) {
+    remoteVSTServerInstance->dispatchControl(0);
+    controlServed(remoteVSTServerInstance);
+  } else
+    mainWait(paintwait ? 5 : INFINITE);
+}
+
+#ifdef MULTISERVER
+// An instance is loaded and stopped on a thread of its own, so a slow dll
+// load, handshake or exit does not hold up the instances the main thread
+// serves. The main thread only creates and deletes the plugins and their
+// windows, it takes the instances from these queues.
+struct InstanceLoad {
+  string partidx;
+  string libname;
+  string fileInfo;
+  int slot;
+  RemoteVSTServer *instance;
+};
+
+std::mutex instanceLock;
+std::vector<InstanceLoad *> loadedInstances;
+std::vector<RemoteVSTServer *> stoppedInstances;
+// slots of instances from accept to release, loads and exits in flight and
+// whether the main thread has stopped serving, all under instanceLock
+bool slotsUsed[MULTISLOTS];
+int instancesBusy = 0;
+bool instancesClosed = false;
+
+int claimSlot() {
+  std::lock_guard<std::mutex> lock(instanceLock);
+
+  for (int i = 0; (i < MULTISLOTS) && !instancesClosed; i++) {
+    if (!slotsUsed[i]) {
+      slotsUsed[i] = true;
+      instancesBusy++;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// a load or exit is done, the slot stays used if the instance now runs
+void instanceDone(int slot, bool running) {
+  std::lock_guard<std::mutex> lock(instanceLock);
+
+  if (!running)
+    slotsUsed[slot] = false;
+  instancesBusy--;
+}
+
+DWORD WINAPI InstanceLoadThreadMain(LPVOID parameter) {
+  InstanceLoad *load = (InstanceLoad *)parameter;
+
+  load->instance = loadInstance(load->libname, load->fileInfo);
+
+  {
+    std::lock_guard<std::mutex> lock(instanceLock);
+    loadedInstances.push_back(load);
+  }
+  SetEvent(controlWake);
+  return 0;
+}
+
+DWORD WINAPI StopThreadMain(LPVOID parameter) {
+  RemoteVSTServer *instance = (RemoteVSTServer *)parameter;
+
+  stopInstance(instance);
+
+  {
+    std::lock_guard<std::mutex> lock(instanceLock);
+    stoppedInstances.push_back(instance);
+  }
+  SetEvent(controlWake);
+  return 0;
+}
+
+// accepts the clients that connect to the instance socket and starts a load
+// thread for each
+DWORD WINAPI AcceptThreadMain(LPVOID parameter) {
+  int listenfd = (int)(intptr_t)parameter;
+  struct pollfd pfd = {listenfd, POLLIN, 0};
+  string line;
+  int ret;
+
+  for (;;) {
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    do {
+      int slot = claimSlot();
+
+      ret = acceptRequest(listenfd, line, slot >= 0);
+
+      if (slot < 0)
+        continue;
+
+      HANDLE loadThread = 0;
+
+      if (ret == 1) {
+        size_t comma1 = line.find(',');
+        size_t comma2 = line.find(',', comma1 + 1);
+        string libname = line.substr(comma1 + 1, comma2 - comma1 - 1);
+
+        if (libname.compare(0, 2, "//") == 0)
+          libname.erase(0, 1);
+
+        InstanceLoad *load = new InstanceLoad{line.substr(0, comma1), libname,
+                                              line.substr(comma2 + 1), slot, 0};
+        loadThread = CreateThread(0, 0, InstanceLoadThreadMain, load, 0, 0);
+        if (!loadThread)
+          delete load;
+      }
+
+      if (loadThread)
+        CloseHandle(loadThread);
+      else
+        instanceDone(slot, false);
+    } while (ret >= 0);
+  }
+  return 0;
+}
+
+// creates the plugins of loaded instances and deletes stopped ones, false
+// once there is nothing left to serve
+bool serveInstances() {
+  std::vector<InstanceLoad *> loaded;
+  std::vector<RemoteVSTServer *> stopped;
+
+  {
+    std::lock_guard<std::mutex> lock(instanceLock);
+    loaded.swap(loadedInstances);
+    stopped.swap(stoppedInstances);
+  }
+
+  for (InstanceLoad *load : loaded) {
+    bool running = load->instance && createInstance(load->instance,
+                                                    load->partidx,
+                                                    load->libname, load->slot);
+    if (running)
+      remoteVSTServerInstances.push_back(load->instance);
+    instanceDone(load->slot, running);
+    delete load;
+  }
+
+  for (RemoteVSTServer *instance : stopped) {
+    int slot = instance->slot;
+
+    releaseInstance(instance);
+    instanceDone(slot, false);
+  }
+
+  std::lock_guard<std::mutex> lock(instanceLock);
+
+  if (remoteVSTServerInstances.empty() && !instancesBusy)
+    instancesClosed = true;
+  return !instancesClosed;
+}
+#endif
+
+#ifdef SERVERPOOL
+// A pooled server is started with "pool,<sockname>,<idle seconds>,<lock fd>"
+// before any plugin is known. It waits with wine and ole already up until a
+// client hands it the usual command line, or exits when idle for too long.
+// The lock fd holds the pool slot for the client that started the server,
+// it is closed once the server listens on the slot name.
+char *waitPool(char *cmdline) {
+  string pool = cmdline;
+  size_t comma1 = pool.find(',');
+  size_t comma2 = pool.find(',', comma1 + 1);
+  size_t comma3 = pool.find(',', comma2 + 1);
+
+  if (comma2 == string::npos)
+    return 0;
+
+  string sockname = pool.substr(comma1 + 1, comma2 - comma1 - 1);
+  int idle = atoi(pool.substr(comma2 + 1).c_str());
+  if (idle <= 0)
+    idle = 300;
+
+  int listenfd = listenInstances(sockname.c_str());
+
+  if (comma3 != string::npos) {
+    int lockfd = atoi(pool.substr(comma3 + 1).c_str());
+    if (lockfd > 2)
+      close(lockfd);
+  }
+
+  if (listenfd < 0)
+    return 0;
+
+  struct pollfd pfd = {listenfd, POLLIN, 0};
+  string line;
+
+  while (poll(&pfd, 1, idle * 1000) > 0) {
+    if (acceptRequest(listenfd, line, 1) == 1) {
+      close(listenfd);
+      return strdup(line.c_str());
+    }
+  }
+
+  close(listenfd);
+  return 0;
+}
+#endif
+
+int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, LPSTR cmdline,
+                   int cmdshow) {
+  char *libname = 0;
+  char *libname2 = 0;
+  char *fileInfo = 0;
+  string partidx;
+  char *outname[10];
+  int offset = 0;
+  int idx = 0;
+  int ci = 0;
+
+  cerr << "DSSI VST plugin server v" << RemotePluginVersion << endl;
+  cerr << "Copyright (c) 2012-2013 Filipe Coelho" << endl;
+  cerr << "Copyright (c) 2010-2011 Kristian Amlie" << endl;
+  cerr << "Copyright (c) 2004-2006 Chris Cannam" << endl;
+  cerr << "LinVst3 version 4.9" << endl;
+
+  SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_SYSTEM_AWARE);
+
+  HRESULT oleret = OleInitialize(NULL);
+
+#ifdef SERVERPOOL
+  if (strncmp(cmdline, "pool,", 5) == 0) {
+    cmdline = waitPool(cmdline);
+    if (!cmdline)
+      exit(0);
+  }
+#endif
+
+  if (cmdline[0] == '\0') {
+    exit(0);
+    // return 1;
+  }
+
+  if (cmdline) {
+    if (cmdline[0] == '"' || cmdline[0] == '\'')
+      offset = 1;
+    for (ci = offset; cmdline[ci]; ++ci) {
+      if (cmdline[ci] == ',') {
+        outname[idx] = strndup(cmdline + offset, ci - offset);
+        ++idx;
+        ++ci;
+        offset = ci;
+      }
+    }
+    outname[idx] = strndup(cmdline + offset, ci - offset);
+  }
+
+  if (idx < 2) {
+    cerr << "Usage: dssi-vst-server <vstname.dll>,<tmpfilebase>" << endl;
+    cerr << "(Command line was: " << cmdline << ")" << endl;
+
+    exit(0);
+  }
+
+  partidx = outname[0];
+  libname2 = outname[1];
+  fileInfo = outname[2];
+  int l = strlen(outname[idx]);
+  if (outname[idx][l - 1] == '"' || outname[idx][l - 1] == '\'')
+    outname[idx][l - 1] = '\0';
+
+  // printf("fileinfo %s\n", fileInfo);
+
+  if (libname2 != NULL) {
+    libname = libname2;
+  } else {
+    cerr << "Usage: dssi-vst-server <vstname.dll>,<tmpfilebase>" << endl;
+    cerr << "(Command line was: " << cmdline << ")" << endl;
+
+    exit(0);
+    // return 1;
+  }
+
+  if (!libname || !libname[0] || !fileInfo || !fileInfo[0]) {
+    cerr << "Usage: dssi-vst-server <vstname.dll>,<tmpfilebase>" << endl;
+    cerr << "(Command line was: " << cmdline << ")" << endl;
+
+    exit(0);
+    // return 1;
+  }
+
+/*
+   struct sched_param param;
+   param.sched_priority = 0;
+   (void)sched_setscheduler(0, SCHED_OTHER, &param);
+*/
+
+  controlWake = CreateEvent(0, FALSE, FALSE, 0);
+
+  remoteVSTServerInstance = startInstance(partidx, libname, fileInfo, 0);
+
+  if (!remoteVSTServerInstance)
+    exit(0);
+
+  MSG msg;
+
+#ifdef MULTISERVER
+  remoteVSTServerInstances.push_back(remoteVSTServerInstance);
+  remoteVSTServerInstance = 0;
+  slotsUsed[0] = true;
+
+  int listenfd = -1;
+  if (idx >= 3)
+    listenfd = listenInstances(outname[3]);
+
+  if (listenfd >= 0) {
+    HANDLE acceptThread =
+        CreateThread(0, 0, AcceptThreadMain, (LPVOID)(intptr_t)listenfd, 0, 0);
+    if (acceptThread)
+      CloseHandle(acceptThread);
+  }
+
+  // one main thread serves the windows and control channels of every
+  // instance, an instance is only dispatched when it has a request waiting
+  while (serveInstances()) {
+    int paintwait = 0;
+
+    for (int loopidx = 0;
+         (loopidx < 10) && PeekMessage(&msg, 0, 0, 0, PM_REMOVE); loopidx++) {
+      RemoteVSTServer *instance = instanceForWindow(msg.hwnd);
+
+      if (instance) {
+        if ((msg.message == WM_TIMER) && (msg.wParam == 678)) {
+          if ((instance->guiVisible == true) && (instance->hostreaper == 1) &&
+              (instance->pparent == 0) && (instance->reaptimecount < 100))
+            instance->guiUpdate();
+        }
+
+        if (msg.message == 15 && !instance->guiVisible) {
+          paintwait = 1;
+          break;
+        }
+      }
+
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    }
+
+    int dispatched = 0;
+
+    for (size_t i = 0; i < remoteVSTServerInstances.size();) {
+      RemoteVSTServer *instance = remoteVSTServerInstances[i];
+
+      if (instance->exiting) {
+        remoteVSTServerInstances.erase(remoteVSTServerInstances.begin() + i);
+        {
+          std::lock_guard<std::mutex> lock(instanceLock);
+          instancesBusy++;
+        }
+        HANDLE stopThread = CreateThread(0, 0, StopThreadMain, instance, 0, 0);
+        if (stopThread)
+          CloseHandle(stopThread);
+        else
+          StopThreadMain(instance);
+        continue;
+      }
+
+      if (instance->m_shmControl3->runServer > 0) {
+        instance->dispatchControl(0);
+        controlServed(instance);
+        dispatched = 1;
+      }
+      i++;
+    }
+
+    if (!dispatched)
+      mainWait(paintwait ? 5 : INFINITE);
+  }
+
+  if (listenfd >= 0)
+    close(listenfd);
+#else
+  while (!remoteVSTServerInstance->exiting) {
+    int paintwait = 0;
+
+    if (remoteVSTServerInstance->wavesthread == 1) {
+      for (int loopidx = 0;
+           (loopidx < 10) && PeekMessage(&msg, 0, 0, 0, PM_REMOVE); loopidx++) {
+        if (remoteVSTServerInstance->exiting)
+          break;
+          
+        if((msg.message == WM_TIMER) && (msg.wParam == 678))
+        {
+        if((remoteVSTServerInstance->guiVisible == true) && (remoteVSTServerInstance->hostreaper == 1) && (remoteVSTServerInstance->pparent == 0) && (remoteVSTServerInstance->reaptimecount < 100))
+        remoteVSTServerInstance->guiUpdate();
+        }          
+
+        if (msg.message == 15 && !remoteVSTServerInstance->guiVisible) {
+          paintwait = 1;
+          break;
+        }
+
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+
+        //if (remoteVSTServerInstance->hidegui == 1)
+        // break;
+        }
+
+      //if (remoteVSTServerInstance->hidegui == 1) {
+      //  remoteVSTServerInstance->hideGUI();
+      //}
+
+      if (remoteVSTServerInstance->exiting)
+        break;
+      serveControl(remoteVSTServerInstance, paintwait);
+    } else {
+      while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+        if (remoteVSTServerInstance->exiting)
+          break;
+          
+        if((msg.message == WM_TIMER) && (msg.wParam == 678))
+        {
+        if((remoteVSTServerInstance->guiVisible == true) && (remoteVSTServerInstance->hostreaper == 1) && (remoteVSTServerInstance->pparent == 0) && (remoteVSTServerInstance->reaptimecount < 100))
+        remoteVSTServerInstance->guiUpdate();
+        }          
+
+        if (msg.message == 15 && !remoteVSTServerInstance->guiVisible) {
+          paintwait = 1;
+          break;
+        }
+
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+
+        //if (remoteVSTServerInstance->hidegui == 1)
+        // break;
+      }
+
+      //if (remoteVSTServerInstance->hidegui == 1) {
+      //  remoteVSTServerInstance->hideGUI();
+      //}
+
+      if (remoteVSTServerInstance->exiting)
+        break;
+      serveControl(remoteVSTServerInstance, paintwait);
+    }
+  }
+
+  finishInstance(remoteVSTServerInstance);
+#endif
+
+  if(oleret == S_OK)
+  OleUninitialize();	
+
   //   if (debugLevel > 0)
   cerr << "dssi-vst-server[1]: exiting" << endl;
 
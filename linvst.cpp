@@ -32,6 +32,13 @@
 
 #include <sys/wait.h>
 
+#ifdef SCANCACHE
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#endif
+
 extern "C" {
 
 #define VST_EXPORT __attribute__((visibility("default")))
@@ -47,6 +54,201 @@ VST_EXPORT AEffect *main(audioMasterCallback audioMaster) {
 }
 }
 
+#ifdef SCANCACHE
+// What VSTPluginMain reports for a plugin is cached in
+// $XDG_CACHE_HOME/linvst3 (~/.cache/linvst3), one file per .vst3 and part
+// index. An entry is only used while the .vst3 size and mtime still match,
+// so a host scan can be answered without starting wine.
+#define SCANCACHEVERSION "LinVst3 scan 2"
+
+std::string scanCacheFile(RemotePluginClient *plugin) {
+  std::string dir;
+  const char *cache = getenv("XDG_CACHE_HOME");
+
+  if (cache && cache[0])
+    dir = cache;
+  else {
+    const char *home = getenv("HOME");
+    if (!home)
+      return "";
+    dir = std::string(home) + "/.cache";
+  }
+  dir += "/linvst3";
+
+  unsigned long long hash = 14695981039346656037ull;
+  std::string key = plugin->m_scanpath + "\n" + plugin->m_scanpart;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+
+  char name[32];
+  sprintf(name, "/%016llx", hash);
+  return dir + name;
+}
+
+std::string scanCacheStamp(RemotePluginClient *plugin) {
+  struct stat st;
+
+  if (stat(plugin->m_scanpath.c_str(), &st))
+    return "";
+  return std::to_string((long long)st.st_size) + " " +
+         std::to_string((long long)st.st_mtime);
+}
+
+bool scanCacheLoad(RemotePluginClient *plugin) {
+  std::string file = scanCacheFile(plugin);
+  std::string stamp = scanCacheStamp(plugin);
+
+  if (file.empty() || stamp.empty())
+    return false;
+
+  std::ifstream in(file.c_str());
+  std::string version, path, part, stamp2, counts, values;
+  RemotePluginClient::ScanInfo info;
+
+  if (!std::getline(in, version) || !std::getline(in, path) ||
+      !std::getline(in, part) || !std::getline(in, stamp2) ||
+      !std::getline(in, counts) || !std::getline(in, info.name) ||
+      !std::getline(in, info.maker) || !std::getline(in, values))
+    return false;
+
+  if ((version != SCANCACHEVERSION) || (path != plugin->m_scanpath) ||
+      (part != plugin->m_scanpart) || (stamp2 != stamp))
+    return false;
+
+  if (sscanf(counts.c_str(), "%d %d %d %d %d %d %d %d", &info.numinputs,
+             &info.numoutputs, &info.numprograms, &info.numparams, &info.flags,
+             &info.delay, &info.uid, &info.category) != 8)
+    return false;
+
+  std::istringstream valuestream(values);
+  float value;
+  while (valuestream >> value)
+    info.params.push_back(value);
+
+  if ((int)info.params.size() != info.numparams)
+    return false;
+
+  plugin->m_scaninfo = info;
+  return true;
+}
+
+void scanCacheSave(RemotePluginClient *plugin, AEffect *eff) {
+  std::string file = scanCacheFile(plugin);
+  std::string stamp = scanCacheStamp(plugin);
+
+  if (file.empty() || stamp.empty())
+    return;
+
+  std::string dir = file.substr(0, file.find_last_of("/"));
+  mkdir(dir.substr(0, dir.find_last_of("/")).c_str(), 0700);
+  mkdir(dir.c_str(), 0700);
+
+  std::string name = plugin->getName();
+  std::string maker = plugin->getMaker();
+  int category = plugin->getEffInt(effGetPlugCategory, 0);
+
+  std::ostringstream values;
+  values.precision(9);
+  for (int i = 0; i < eff->numParams; i++)
+    values << (i ? " " : "") << plugin->getParameter(i);
+
+  // written under another name and renamed, so concurrent scans never read
+  // half a file
+  std::string tmp = file + "." + std::to_string(getpid());
+  std::ofstream out(tmp.c_str());
+
+  out << SCANCACHEVERSION << "\n"
+      << plugin->m_scanpath << "\n"
+      << plugin->m_scanpart << "\n"
+      << stamp << "\n"
+      << eff->numInputs << " " << eff->numOutputs << " " << eff->numPrograms
+      << " " << eff->numParams << " " << eff->flags << " "
+      << eff->initialDelay << " " << eff->uniqueID << " " << category << "\n"
+      << name << "\n"
+      << maker << "\n"
+      << values.str() << "\n";
+  out.close();
+
+  if (!out || rename(tmp.c_str(), file.c_str()))
+    unlink(tmp.c_str());
+}
+
+// Starts the server of a plugin that was answered from the cache so far and
+// replays what the host has set up in the meantime. The first thread that
+// needs the server starts it, the others wait for it here.
+bool lazyStart(AEffect *effect, RemotePluginClient *plugin) {
+  std::lock_guard<std::mutex> lock(plugin->m_lazylock);
+
+  if (plugin->m_lazy != 1)
+    return plugin->m_lazy == 0;
+
+  // started from a thread of its own, which is what LVRT makes realtime and
+  // what the server and the client threads inherit that from
+  std::thread([plugin] { plugin->startServer(); }).join();
+
+  if (plugin->m_runok != 0) {
+    plugin->m_lazy = 2;
+    return false;
+  }
+
+  // the client sizes its caches and locks from these
+  int ins = plugin->getInputCount();
+  int outs = plugin->getOutputCount();
+  int progs = plugin->getProgramCount();
+  int params = plugin->getParameterCount();
+  int delay = plugin->getinitialDelay();
+
+  if ((ins != effect->numInputs) || (outs != effect->numOutputs) ||
+      (progs != effect->numPrograms) || (params != effect->numParams) ||
+      (delay != effect->initialDelay)) {
+    effect->numInputs = ins;
+    effect->numOutputs = outs;
+    effect->numPrograms = progs;
+    effect->numParams = params;
+    effect->initialDelay = delay;
+    plugin->m_audioMaster(effect, audioMasterIOChanged, 0, 0, 0, 0);
+  }
+
+  if (plugin->m_lazyopen)
+    plugin->EffectOpen();
+  if (plugin->m_lazysamplerate > 0)
+    plugin->setSampleRate(plugin->m_lazysamplerate);
+  if (plugin->m_lazyblocksize > 0)
+    plugin->setBufferSize(plugin->m_lazyblocksize);
+
+  int count = std::min(params, (int)plugin->m_lazyparams.size());
+  for (int i = 0; i < count; i++) {
+    if (plugin->m_lazyset[i])
+      plugin->setParameter(i, plugin->m_lazyparams[i]);
+  }
+
+  plugin->m_lazy = 0;
+  return true;
+}
+
+// parameter calls before the server is started are answered from the values
+// in the scan cache and what the host set since, true if answered
+bool lazyParameter(RemotePluginClient *plugin, int index, float *value,
+                   bool set) {
+  std::lock_guard<std::mutex> lock(plugin->m_lazylock);
+
+  if (plugin->m_lazy == 0)
+    return false;
+
+  if ((plugin->m_lazy == 1) && (index >= 0) &&
+      (index < (int)plugin->m_lazyparams.size())) {
+    if (set) {
+      plugin->m_lazyparams[index] = *value;
+      plugin->m_lazyset[index] = 1;
+    } else
+      *value = plugin->m_lazyparams[index];
+  }
+  return true;
+}
+#endif
+
 VstIntPtr dispatcher(AEffect *effect, VstInt32 opcode, VstInt32 index,
                      VstIntPtr value, void *ptr, float opt) {
   RemotePluginClient *plugin = (RemotePluginClient *)effect->object;
@@ -79,6 +281,79 @@ VstIntPtr dispatcher(AEffect *effect, VstInt32 opcode, VstInt32 index,
     return 0;
   }
 
+#ifdef SCANCACHE
+  if (plugin->m_lazy) {
+    switch (opcode) {
+    case effGetEffectName:
+      strcpy((char *)ptr, plugin->m_scaninfo.name.c_str());
+      return 1;
+
+    case effGetVendorString:
+      strcpy((char *)ptr, plugin->m_scaninfo.maker.c_str());
+      return 1;
+
+    case effGetPlugCategory:
+      return plugin->m_scaninfo.category;
+
+    case effGetVstVersion:
+      return kVstVersion;
+
+    case effOpen:
+      plugin->m_lazyopen = 1;
+      return 0;
+
+    case effSetSampleRate:
+      plugin->m_lazysamplerate = opt;
+      return 0;
+
+    case effSetBlockSize:
+      plugin->m_lazyblocksize = value;
+      return 0;
+
+    case effMainsChanged:
+      // suspending a plugin that never ran needs no server
+      if (value == 0)
+        return 0;
+      if (!lazyStart(effect, plugin))
+        return 0;
+      break;
+
+    // sent from the audio thread, which must not start the server
+    case effProcessEvents:
+      return 0;
+
+#ifndef CANDOEFF
+    case effCanDo:
+      if (ptr && strcmp((char *)ptr, "hasCockosExtensions"))
+        return 1;
+      if (!lazyStart(effect, plugin))
+        return 0;
+      break;
+#endif
+
+    case effEditGetRect:
+    case effEditIdle:
+    case effEditClose:
+      return 0;
+
+#ifdef VESTIGE
+    case effGetInputProperties:
+    case effGetOutputProperties:
+      break;
+#endif
+
+    case effClose:
+      delete plugin;
+      return 0;
+
+    default:
+      if (!lazyStart(effect, plugin))
+        return 0;
+      break;
+    }
+  }
+#endif
+
   switch (opcode) {
   case effEditGetRect:
     if (plugin->editopen == 1)
@@ -395,6 +670,11 @@ void setParameter(AEffect *effect, VstInt32 index, float parameter) {
   if (!plugin)
     return;
 
+#ifdef SCANCACHE
+  if (plugin->m_lazy && lazyParameter(plugin, index, &parameter, true))
+    return;
+#endif
+
   if ((plugin->m_bufferSize > 0) && (plugin->m_numInputs >= 0) &&
       (plugin->m_numOutputs >= 0)) {
     plugin->setParameter(index, parameter);
@@ -409,6 +689,11 @@ float getParameter(AEffect *effect, VstInt32 index) {
   if (!plugin)
     return retval;
 
+#ifdef SCANCACHE
+  if (plugin->m_lazy && lazyParameter(plugin, index, &retval, false))
+    return retval;
+#endif
+
   if ((plugin->m_bufferSize > 0) && (plugin->m_numInputs >= 0) &&
       (plugin->m_numOutputs >= 0)) {
     retval = plugin->getParameter(index);
@@ -444,6 +729,31 @@ void initEffect(AEffect *eff, RemotePluginClient *plugin) {
 #endif
 }
 
+#ifdef SCANCACHE
+void initEffectCached(AEffect *eff, RemotePluginClient *plugin) {
+  memset(eff, 0x0, sizeof(AEffect));
+  eff->magic = kEffectMagic;
+  eff->dispatcher = dispatcher;
+  eff->setParameter = setParameter;
+  eff->getParameter = getParameter;
+  eff->numInputs = plugin->m_scaninfo.numinputs;
+  eff->numOutputs = plugin->m_scaninfo.numoutputs;
+  eff->numPrograms = plugin->m_scaninfo.numprograms;
+  eff->numParams = plugin->m_scaninfo.numparams;
+  eff->flags = plugin->m_scaninfo.flags;
+  eff->initialDelay = plugin->m_scaninfo.delay;
+  eff->object = (void *)plugin;
+  eff->uniqueID = plugin->m_scaninfo.uid;
+  plugin->m_lazyparams = plugin->m_scaninfo.params;
+  plugin->m_lazyset.assign(plugin->m_lazyparams.size(), 0);
+  eff->version = 100;
+  eff->processReplacing = process;
+#ifdef DOUBLEP
+  eff->processDoubleReplacing = processDouble;
+#endif
+}
+#endif
+
 void errwin2() {
   Window window = 0;
   Window ignored = 0;
@@ -514,7 +824,28 @@ VST_EXPORT AEffect *VSTPluginMain(audioMasterCallback audioMaster) {
     return 0;
   }
 
+#ifdef SCANCACHE
+  if (scanCacheLoad(plugin)) {
+    plugin->theEffect = &plugin->theEffect2;
+    initEffectCached(plugin->theEffect, plugin);
+  } else {
+    plugin->startServer();
+    plugin->m_lazy = 0;
+
+    if (plugin->m_runok == 1) {
+      std::cerr << "LinVst Error: lin-vst-server not found or vst dll load "
+                   "timeout or LinVst version mismatch"
+                << std::endl;
+      delete plugin;
+      return 0;
+    }
+
+    initEffect(plugin->theEffect, plugin);
+    scanCacheSave(plugin, plugin->theEffect);
+  }
+#else
   initEffect(plugin->theEffect, plugin);
+#endif
 
 #ifdef EMBED
   XInitThreads();
@@ -11,6 +11,90 @@
 #include <syscall.h>
 
 #include <atomic>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Grows or shrinks the locked prefix of a shared memory region to want
+// bytes, page rounded and at most max. Only what the audio threads touch
+// for the current configuration gets locked, the rest of the segment is
+// left to be faulted in (memfd pages are not allocated until touched).
+inline void flockrange(char *base, size_t *locked, size_t want, size_t max) {
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+
+  want = ((want + pagesize - 1) / pagesize) * pagesize;
+  max = ((max + pagesize - 1) / pagesize) * pagesize;
+
+  if (want > max)
+    want = max;
+
+  if (want > *locked) {
+    if (mlock(base + *locked, want - *locked) != 0) {
+      perror("mlock fail1");
+      return;
+    }
+  } else if (want < *locked)
+    munlock(base + want, *locked - want);
+
+  *locked = want;
+}
+
+inline long long fnanotime() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#ifdef SPINWAIT
+#ifndef SPINMAXNS
+#define SPINMAXNS 50000
+#endif
+
+// spin on the futex count for up to spinns before the caller falls back to
+// FUTEX_WAIT, returns true if the count was taken while spinning
+inline bool fspin(std::atomic_int *futexp, long long spinns) {
+  if (spinns <= 0)
+    return false;
+
+  long long spinend = fnanotime() + spinns;
+
+  for (int i = 1;; i++) {
+    int value = atomic_load_explicit(futexp, std::memory_order_acquire);
+    if ((value > 0) &&
+        std::atomic_compare_exchange_weak(futexp, &value, value - 1))
+      return true;
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+    if (((i & 63) == 0) && (fnanotime() >= spinend))
+      return false;
+  }
+}
+
+// running average of the time the other side takes to answer, measured by
+// that side so wake latency is not part of it. The spin budget is half as
+// much again as the average or nothing once that is longer than SPINMAXNS.
+inline long long fspinbudget(long long *turnaround, long long ns) {
+  // with one cpu the other side cannot run while this one spins
+  static const bool onecpu = sysconf(_SC_NPROCESSORS_ONLN) < 2;
+
+  if (ns < 0 || onecpu)
+    return 0;
+
+  *turnaround += (ns - *turnaround) / 8;
+
+  long long budget = *turnaround + (*turnaround / 2);
+
+  if (budget > SPINMAXNS)
+    return 0;
+  return budget;
+}
+#endif
 
 struct alignas(64) amessage {
   int flags;
@@ -33,50 +117,439 @@ struct alignas(64) vinfo {
     int winerror;
   };
 
+// Each futex word shares its line only with its own waiter count, and the
+// request, the scalar reply and each bulk buffer start on lines of their own,
+// so a side spinning or sleeping on one word is not disturbed by the other
+// side filling in a payload.
 //#ifdef VST32
 //struct alignas(64)  ShmControl
 //#else
 struct alignas(64) ShmControl
 //#endif
 {
-  std::atomic_int runServer;
-  std::atomic_int runClient;
+  alignas(64) std::atomic_int runServer;
   std::atomic_int nwaitersserver;
+  alignas(64) std::atomic_int runClient;
   std::atomic_int nwaitersclient;
   // int runServer;
   // int runClient;
-  RemotePluginOpcode ropcode;
-  int retint;
-  float retfloat;
-  char retstr[512];
+  alignas(64) RemotePluginOpcode ropcode;
   int opcode;
   int value;
   int value2;
   int value3;
   int value4;
   float floatvalue;
+#ifdef SPINWAIT
+  // when the client posted the request
+  alignas(8) long long posttime;
+#endif
+  alignas(64) int retint;
+  float retfloat;
   bool retbool;
-  char timeget[sizeof(VstTimeInfo)];
-  char timeset[sizeof(VstTimeInfo)];
-  char amptr[sizeof(amessage)];
-  char vret[sizeof(vinfo)];
-  char wret[sizeof(winmessage)];
+#ifdef SPINWAIT
+  // ns the server spent on the request
+  int proctime;
+#endif
+#ifdef ASYNCLOAD
+  // odd while a state load runs on the server, bumped at start and end
+  std::atomic_int loadstatus;
+#endif
+#ifdef PARBATCH
+  // bumped by the server after it applies parameter values
+  std::atomic_int displaygen;
+#endif
+  alignas(64) char retstr[512];
+  alignas(64) char timeget[sizeof(VstTimeInfo)];
+  int timeinit;
+  alignas(64) char timeset[sizeof(VstTimeInfo)];
+  alignas(64) char amptr[sizeof(amessage)];
+  alignas(64) char vret[sizeof(vinfo)];
+  alignas(64) char wret[sizeof(winmessage)];
 #ifndef VESTIGE
-  char vpin[sizeof(VstPinProperties)];
+  alignas(64) char vpin[sizeof(VstPinProperties)];
 #endif
 #ifdef MIDIEFF
-  char midikey[sizeof(MidiKeyName)];
+  alignas(64) char midikey[sizeof(MidiKeyName)];
   char midiprogram[sizeof(MidiProgramName)];
   char midiprogramcat[sizeof(MidiProgramCategory)];
   char vstspeaker[sizeof(VstSpeakerArrangement)];
   char vstspeaker2[sizeof(VstSpeakerArrangement)];
 #endif
 #ifdef CANDOEFF
-  char sendstr[512];
+  alignas(64) char sendstr[512];
 #endif
-  int createthread;
+  alignas(64) int createthread;
   int parfin;
-  int timeinit;
 };
 
+// the client and the server (64 or 32 bit) must agree on this layout
+static_assert(sizeof(RemotePluginOpcode) == 4, "ShmControl opcode size");
+static_assert(sizeof(VstTimeInfo) <= 124, "ShmControl time info size");
+static_assert(offsetof(ShmControl, runServer) == 0, "ShmControl layout");
+static_assert(offsetof(ShmControl, runClient) == 64, "ShmControl layout");
+static_assert(offsetof(ShmControl, ropcode) == 128, "ShmControl layout");
+static_assert(offsetof(ShmControl, retint) == 192, "ShmControl layout");
+static_assert(offsetof(ShmControl, retstr) == 256, "ShmControl layout");
+static_assert(offsetof(ShmControl, timeget) == 768, "ShmControl layout");
+static_assert(offsetof(ShmControl, timeset) == 896, "ShmControl layout");
+static_assert(offsetof(ShmControl, amptr) == 1024, "ShmControl layout");
+static_assert(offsetof(ShmControl, vret) == 1088, "ShmControl layout");
+static_assert(offsetof(ShmControl, wret) == 1216, "ShmControl layout");
+static_assert(alignof(ShmControl) == 64, "ShmControl layout");
+#ifdef SPINWAIT
+static_assert(offsetof(ShmControl, posttime) == 160, "ShmControl layout");
+static_assert(offsetof(ShmControl, proctime) < 256, "ShmControl layout");
+#endif
+#ifdef ASYNCLOAD
+static_assert(offsetof(ShmControl, loadstatus) < 256, "ShmControl layout");
+#endif
+#ifdef PARBATCH
+static_assert(offsetof(ShmControl, displaygen) < 256, "ShmControl layout");
+#endif
+
+// the size for the build flags in use, each optional block takes whole lines
+#define SHMCONTROLLINES(sz) ((((sz) + 63) / 64) * 64)
+
+static_assert(sizeof(ShmControl) == 1280
+#ifndef VESTIGE
+                                        + SHMCONTROLLINES(
+                                              sizeof(VstPinProperties))
+#endif
+#ifdef MIDIEFF
+                                        + SHMCONTROLLINES(
+                                              sizeof(MidiKeyName) +
+                                              sizeof(MidiProgramName) +
+                                              sizeof(MidiProgramCategory) +
+                                              2 * sizeof(VstSpeakerArrangement))
+#endif
+#ifdef CANDOEFF
+                                        + 512
+#endif
+                                        + 64,
+              "ShmControl size");
+
+// waiters on runServer are counted in nwaitersserver and waiters on runClient
+// in nwaitersclient, whichever side is doing the waiting
+inline std::atomic_int *fwaiters(ShmControl *m_shmControlptr,
+                                 std::atomic_int *futexp) {
+  if (futexp == &m_shmControlptr->runServer)
+    return &m_shmControlptr->nwaitersserver;
+  return &m_shmControlptr->nwaitersclient;
+}
+
+#ifdef SYSEX
+// Events are packed one after the other in the event areas. A sysex dump
+// follows its event on an 8 byte boundary and the event's sysexDump holds
+// the offset from the event to the dump until evlink turns it back into a
+// pointer in place.
+inline int evdumpbytes(VstEvent *ev) {
+  VstMidiSysexEvent *sysex = (VstMidiSysexEvent *)ev;
+  return (sysex->dumpBytes > 0 && sysex->sysexDump) ? sysex->dumpBytes : 0;
+}
+
+inline int evpackedsize(VstEvent *ev) {
+  if (ev->type != kVstSysExType)
+    return ev->byteSize + (2 * sizeof(int));
+  return ((sizeof(VstMidiSysexEvent) + 7) & ~7) + ((evdumpbytes(ev) + 7) & ~7);
+}
+
+inline int evpack(char *dst, VstEvent *ev) {
+  if (ev->type != kVstSysExType) {
+    int size = ev->byteSize + (2 * sizeof(int));
+    memcpy(dst, ev, size);
+    return size;
+  }
+
+  VstMidiSysexEvent *sysex = (VstMidiSysexEvent *)dst;
+  int offset = (sizeof(VstMidiSysexEvent) + 7) & ~7;
+  int dumpbytes = evdumpbytes(ev);
+
+  memcpy(dst, ev, sizeof(VstMidiSysexEvent));
+  memcpy(dst + offset, ((VstMidiSysexEvent *)ev)->sysexDump, dumpbytes);
+  sysex->dumpBytes = dumpbytes;
+  sysex->sysexDump = (char *)(intptr_t)offset;
+  return offset + ((dumpbytes + 7) & ~7);
+}
+
+// returns the packed size of the event at src
+inline int evlink(char *src) {
+  VstEvent *ev = (VstEvent *)src;
+
+  if (ev->type != kVstSysExType)
+    return ev->byteSize + (2 * sizeof(int));
+
+  VstMidiSysexEvent *sysex = (VstMidiSysexEvent *)src;
+  int offset = (int)(intptr_t)sysex->sysexDump;
+
+  sysex->sysexDump = src + offset;
+  return offset + ((sysex->dumpBytes + 7) & ~7);
+}
+#endif
+
+#ifdef AMRING
+// Fire and forget audioMaster callbacks (automate, begin/end edit and output
+// events) are queued here by the server and replayed by the client at the
+// end of process() or by the AMThread. One entry per callback or per event.
+// Any server thread may push without a lock: a producer claims entries by
+// moving head on with a CAS and publishes each entry through its seq, the
+// client is the only consumer. seq is the position the entry is free for
+// (the client sets it to the entry's index) and one past that once filled.
+struct alignas(64) AMEntry {
+  std::atomic_uint seq;
+  int opcode;
+  int index;
+  float value;
+  int size;
+  char data[44];
+};
+
+static_assert(sizeof(AMEntry) == 64, "AMEntry size");
+static_assert((AMRINGCOUNT & (AMRINGCOUNT - 1)) == 0, "AMRINGCOUNT");
+
+struct AMRing {
+  alignas(64) std::atomic_uint head;
+  alignas(64) std::atomic_uint tail;
+  // kicks posted on runServer of the callback channel that only ask the
+  // AMThread to drain the ring, they get no reply
+  alignas(64) std::atomic_int kick;
+  alignas(64) AMEntry entry[AMRINGCOUNT];
+};
+#endif
+
+#ifdef PARAMQUEUE
+// Host parameter changes for the next block with their sample offset, in
+// the order the host made them. The client writes the queue at the end of
+// the process event area when it sends a block, the server hands it to the
+// plugin's parameter queues before processing.
+struct ParamChange {
+  int index;
+  int offset;
+  float value;
+};
+
+struct ParamQueue {
+  int count;
+  ParamChange entry[PARQUEUECOUNT];
+};
+
+static_assert((PARQUEUECOUNT & (PARQUEUECOUNT - 1)) == 0, "PARQUEUECOUNT");
+
+inline ParamQueue *pqueue(char *shm2) {
+  return (ParamQueue *)(shm2 + VSTEVENTS_PROCESS - sizeof(ParamQueue));
+}
+#endif
+
+#ifdef PARBATCH
+// RemotePluginBatch carries up to PARBATCHCOUNT parameter queries
+// (name, label, display, canBeAutomated) in one control channel round trip.
+struct BatchEntry {
+  int ropcode;
+  int value;
+  int retint;
+  char retstr[PARBATCHSTR];
+};
+
+struct BatchRequest {
+  alignas(64) int count;
+  alignas(64) BatchEntry entry[PARBATCHCOUNT];
+};
+
+static_assert(sizeof(BatchEntry) == 128, "BatchEntry size");
+#endif
+
+#ifdef OUTEVENTS
+// Events the plugin sends from inside process() are packed here by the
+// server and handed to the host by the client once the block is back.
+// The client empties it, the server only appends during a block.
+struct OutEvents {
+  int count;
+  int size;
+  alignas(64) char data[OUTEVENTSSIZE];
+};
+#endif
+
+// Startup handshake on the first int of the process area. Each side
+// stores its state with fstartset, which wakes the other side sleeping in
+// fstartwait on the same word.
+enum StartupState {
+  StartupNone = 0,
+  // client gives up waiting for StartupMapped
+  StartupClientTimeout = 4,
+  // client has seen the mapping, 32 or 64 bit plugin
+  StartupClientOk = 2,
+  StartupClientOk386 = 3,
+  // server has mapped the segment
+  StartupMapped = 490,
+  // server has loaded the dll and started its threads, or failed to
+  StartupServerReady = 2000,
+  StartupServerError = 2001,
+  // client has seen StartupServerReady
+  StartupClientAck = 6000
+};
+
+#define STARTUPTIMEOUT 60000
+
+inline long long fstartms() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+inline void fstartset(int *word, int state) {
+  __atomic_store_n(word, state, __ATOMIC_RELEASE);
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Sleeps until the other side moves the word off state, returns the new
+// state or -1 after timeoutms.
+inline int fstartwait(int *word, int state, int timeoutms) {
+  long long end = fstartms() + timeoutms;
+
+  for (;;) {
+    int value = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+
+    if (value != state)
+      return value;
+
+    long long left = end - fstartms();
+    if (left <= 0)
+      return -1;
+
+    timespec ts;
+    ts.tv_sec = left / 1000;
+    ts.tv_nsec = (left % 1000) * 1000000;
+    syscall(SYS_futex, word, FUTEX_WAIT, state, &ts, NULL, 0);
+  }
+}
+
+#ifdef STATS
+struct RemotePluginStats {
+  std::atomic<long long> wakesent{0};
+  std::atomic<long long> wakeskipped{0};
+  std::atomic<long long> parblocks{0};
+  std::atomic<long long> parvisited{0};
+  std::atomic<long long> chunksent{0};
+  std::atomic<long long> chunkskipped{0};
+};
+#endif
+
+#ifdef PCACHE
+// The parameter cache is a segment of its own, created by the client once
+// the parameter count is known. It holds the summary bits (one per 64
+// parameters), the dirty bits (one per parameter), the values the plugin
+// has applied and the values set by the host, each array on its own lines.
+#ifdef PDISPLAY
+// Display string of one parameter, written by the server under the seq
+// lock. It is valid while filled is one past inval, every value change
+// bumps inval.
+struct ParamDisplay {
+  std::atomic_int seq;
+  std::atomic_int inval;
+  std::atomic_int filled;
+  char text[PDISPLAYLEN];
+};
+#endif
+
+#ifdef PMETA
+// Name, label and properties of one parameter. The whole table is written
+// by the server under one seq lock, zero means it has not been built.
+struct ParamMeta {
+  char name[PMETANAMELEN];
+  char label[PMETALABELLEN];
+  int automate;
+  int steps;
+  int flags;
+  float defvalue;
+};
+#endif
+
+struct ParamCache {
+  std::atomic<uint64_t> *summary;
+  std::atomic<uint64_t> *dirty;
+  float *value;
+  float *update;
+#ifdef PDISPLAY
+  ParamDisplay *display;
+#endif
+#ifdef PMETA
+  std::atomic_int *metaseq;
+  ParamMeta *meta;
+#endif
+  int count;
+  int words;
+  int summarywords;
+};
+
+inline size_t pcachealign(size_t sz) { return ((sz + 63) / 64) * 64; }
+
+inline size_t pcachesize(int count) {
+  int words = (count + 63) / 64;
+  int summarywords = (words + 63) / 64;
+
+  return pcachealign(summarywords * sizeof(uint64_t)) +
+         pcachealign(words * sizeof(uint64_t)) +
+         pcachealign(count * sizeof(float)) * 2
+#ifdef PDISPLAY
+         + pcachealign(count * sizeof(ParamDisplay))
+#endif
+#ifdef PMETA
+         + pcachealign(sizeof(std::atomic_int)) +
+         pcachealign(count * sizeof(ParamMeta))
+#endif
+      ;
+}
+
+inline void pcachelayout(char *base, int count, ParamCache *cache) {
+  cache->count = count;
+  cache->words = (count + 63) / 64;
+  cache->summarywords = (cache->words + 63) / 64;
+  cache->summary = (std::atomic<uint64_t> *)base;
+  base += pcachealign(cache->summarywords * sizeof(uint64_t));
+  cache->dirty = (std::atomic<uint64_t> *)base;
+  base += pcachealign(cache->words * sizeof(uint64_t));
+  cache->value = (float *)base;
+  base += pcachealign(count * sizeof(float));
+  cache->update = (float *)base;
+  base += pcachealign(count * sizeof(float));
+#ifdef PDISPLAY
+  cache->display = (ParamDisplay *)base;
+  base += pcachealign(count * sizeof(ParamDisplay));
+#endif
+#ifdef PMETA
+  cache->metaseq = (std::atomic_int *)base;
+  base += pcachealign(sizeof(std::atomic_int));
+  cache->meta = (ParamMeta *)base;
+#endif
+}
+
+// the value is written before the bits, the server clears the summary bit
+// before the word so a late bit is picked up on the next block
+inline void pdirtyset(ParamCache *cache, int idx) {
+  cache->dirty[idx >> 6].fetch_or(1ULL << (idx & 63),
+                                  std::memory_order_release);
+  cache->summary[idx >> 12].fetch_or(1ULL << ((idx >> 6) & 63),
+                                     std::memory_order_release);
+}
+
+inline void pdirtyclear(ParamCache *cache) {
+  for (int i = 0; i < cache->summarywords; i++)
+    cache->summary[i].store(0, std::memory_order_relaxed);
+  for (int i = 0; i < cache->words; i++)
+    cache->dirty[i].store(0, std::memory_order_relaxed);
+}
+
+#ifdef PDISPLAY
+inline void pdisplayinval(ParamCache *cache, int idx) {
+  if (idx >= 0 && idx < cache->count)
+    cache->display[idx].inval.fetch_add(1, std::memory_order_release);
+}
+
+inline void pdisplayinvalall(ParamCache *cache) {
+  for (int i = 0; i < cache->count; i++)
+    cache->display[i].inval.fetch_add(1, std::memory_order_release);
+}
+#endif
+#endif
+
 #endif
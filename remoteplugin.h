@@ -18,13 +18,37 @@
 #define VSTEVENTS_PROCESS (1024 * 128)
 #define VSTEVENTS_SEND (1024 * 128)
 
-  struct alignas(64) ParamState {
-  float value;
-  float valueupdate;
-  char changed;
-  };
+#ifdef AMRING
+#define AMRINGCOUNT 1024
+#endif
+
+#ifdef PARAMQUEUE
+#define PARQUEUECOUNT 1024
+#endif
+
+#ifdef PDISPLAY
+#define PDISPLAYLEN 36
+#endif
+
+#ifdef PMETA
+// names go up to 32 chars and labels up to kVstMaxParamStrLen (24) plus the nul
+#define PMETANAMELEN 36
+#define PMETALABELLEN 28
+#endif
 
-#define PARCACHE (sizeof(ParamState) * 10000)
+#ifdef PARBATCH
+#define PARBATCHCOUNT 1024
+#define PARBATCHSTR 116
+#endif
+
+#ifdef OUTEVENTS
+#define OUTEVENTSCOUNT 1024
+#define OUTEVENTSSIZE (1024 * 64)
+#endif
+
+#ifdef HUGEPAGES
+#define HUGEPAGESIZE (1024 * 1024 * 2)
+#endif
 
 const float RemotePluginVersion = 0.986;
 
@@ -114,6 +138,15 @@ enum RemotePluginOpcode {
 #ifdef CHUNKBUF
   RemotePluginGetBuf,
   RemotePluginSetBuf,
+#endif
+#ifdef CHUNKMAP
+  RemotePluginSetChunkMap,
+#endif
+#ifdef PARBATCH
+  RemotePluginBatch,
+#endif
+#ifdef PCACHE
+  RemotePluginParCache,
 #endif
   RemotePluginNoOpcode = 9999
 };
@@ -25,6 +25,7 @@
 
 #include "remotepluginclient.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <iostream>
@@ -38,6 +39,13 @@
 
 #include "paths.h"
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
 #define hidegui2 77775634
 
 void *RemotePluginClient::AMThread() {
@@ -49,7 +57,9 @@ void *RemotePluginClient::AMThread() {
   int ok = 1;
   char retstr2[512];
 
-  int timeout = 50;
+  // no timeout, whoever sets m_threadbreak posts runServer to stop the
+  // thread
+  int timeout = -1;
 
   VstTimeInfo *timeInfo;
   VstTimeInfo *timeInfo2;
@@ -91,6 +101,14 @@ void *RemotePluginClient::AMThread() {
       }
     }
 
+#ifdef AMRING
+    if (atomic_load_explicit(&m_amring->kick, std::memory_order_seq_cst) > 0) {
+      std::atomic_fetch_sub_explicit(&m_amring->kick, 1, std::memory_order_seq_cst);
+      amDrain();
+      continue;
+    }
+#endif
+
     RemotePluginOpcode opcode = RemotePluginNoOpcode;
     opcode = m_shmControlptrth->ropcode;
 
@@ -99,6 +117,11 @@ void *RemotePluginClient::AMThread() {
       if (m_threadbreak)
         break;
 
+#ifdef AMRING
+      // queued callbacks go to the host before this one
+      amDrain();
+#endif
+
       switch (opcode) {
 /*              
       case audioMasterSetTime:
@@ -114,9 +137,15 @@ void *RemotePluginClient::AMThread() {
         optval = m_shmControlptrth->floatvalue;
         retval = 0;
 #ifdef PCACHE
-        ParamState* pstate = (ParamState*)m_shm6;        
-        pstate[idx].value = optval;            
+        if (idx >= 0 && idx < m_parcache.count)
+          m_parcache.value[idx] = optval;
 #endif                
+#ifdef PARBATCH
+        paramInvalidate(false);
+#endif
+#ifdef CHUNKHASH
+        chunkInvalidate();
+#endif
         retval =
             m_audioMaster(theEffect, audioMasterAutomate, idx, 0, 0, optval);
         m_shmControlptrth->retint = retval;
@@ -158,7 +187,11 @@ void *RemotePluginClient::AMThread() {
 
         for (int i = 0; i < els; i++) {
           VstEvent *bsize = (VstEvent *)&m_shm4[sizeidx];
+#ifdef SYSEX
+          size = evlink(&m_shm4[sizeidx]);
+#else
           size = bsize->byteSize + (2 * sizeof(VstInt32));
+#endif
           evptr->events[i] = bsize;
           sizeidx += size;
         }
@@ -173,6 +206,9 @@ void *RemotePluginClient::AMThread() {
         if ((am.incount != m_numInputs) || (am.outcount != m_numOutputs)) {
           if ((am.incount + am.outcount) * m_bufferSize * sizeof(float) <
               (PROCESSSIZE)) {
+            // the old counts stay in use until process() picks these up
+            lockShm(std::max(am.incount, m_numInputs),
+                    std::max(am.outcount, m_numOutputs), -1);
             m_updateio = 1;
             m_updatein = am.incount;
             m_updateout = am.outcount;
@@ -183,13 +219,26 @@ void *RemotePluginClient::AMThread() {
         if (am.delay != m_delay) {
           m_delay = am.delay;
           theEffect->initialDelay = am.delay;
+#ifdef PIPELINE
+          if (m_bufferSize > 0)
+            theEffect->initialDelay += m_bufferSize;
+#endif
         }
+#ifdef PARBATCH
+        paramInvalidate(true);
+#endif
         retval = 0;
         retval = m_audioMaster(theEffect, audioMasterIOChanged, 0, 0, 0, 0);
         m_shmControlptrth->retint = retval;
         break;
 
       case audioMasterUpdateDisplay:
+#ifdef PARBATCH
+        paramInvalidate(true);
+#endif
+#ifdef CHUNKHASH
+        chunkInvalidate();
+#endif
         retval = 0;
         retval = m_audioMaster(theEffect, audioMasterUpdateDisplay, 0, 0, 0, 0);
         m_shmControlptrth->retint = retval;
@@ -322,6 +371,118 @@ void *RemotePluginClient::AMThread() {
   return 0;
 }
 
+#ifdef AMRING
+void RemotePluginClient::amDrain() {
+  unsigned int tail =
+      atomic_load_explicit(&m_amring->tail, std::memory_order_relaxed);
+
+  if (m_amring->entry[tail & (AMRINGCOUNT - 1)].seq.load(
+          std::memory_order_acquire) != tail + 1)
+    return;
+
+  // the process thread and the AMThread both drain, one at a time
+  if (std::atomic_exchange_explicit(&m_amdrain, 1, std::memory_order_acquire))
+    return;
+
+  tail = atomic_load_explicit(&m_amring->tail, std::memory_order_relaxed);
+  unsigned int start = tail;
+
+  m_amevents.numEvents = 0;
+  m_amevents.reserved = 0;
+
+  // stops at the first entry a producer has not filled in yet
+  for (;;) {
+    AMEntry *entry = &m_amring->entry[tail & (AMRINGCOUNT - 1)];
+
+    if (entry->seq.load(std::memory_order_acquire) != tail + 1)
+      break;
+
+    if (entry->opcode == audioMasterProcessEvents) {
+      m_amevents.events[m_amevents.numEvents] = (VstEvent *)entry->data;
+      m_amevents.numEvents++;
+    } else {
+      if (m_amevents.numEvents > 0) {
+        if (theEffect)
+          m_audioMaster(theEffect, audioMasterProcessEvents, 0, 0,
+                        (VstEvents *)&m_amevents, 0);
+        m_amevents.numEvents = 0;
+      }
+
+      if (theEffect) {
+        switch (entry->opcode) {
+        case audioMasterAutomate: {
+#ifdef PCACHE
+          if (entry->index >= 0 && entry->index < m_parcache.count)
+            m_parcache.value[entry->index] = entry->value;
+#endif
+#ifdef PARBATCH
+          paramInvalidate(false);
+#endif
+#ifdef CHUNKHASH
+          chunkInvalidate();
+#endif
+          m_audioMaster(theEffect, audioMasterAutomate, entry->index, 0, 0,
+                        entry->value);
+        } break;
+
+        case audioMasterBeginEdit:
+        case audioMasterEndEdit:
+          m_audioMaster(theEffect, entry->opcode, entry->index, 0, 0, 0);
+          break;
+
+        default:
+          break;
+        }
+      }
+    }
+    tail++;
+  }
+
+  if ((m_amevents.numEvents > 0) && theEffect)
+    m_audioMaster(theEffect, audioMasterProcessEvents, 0, 0,
+                  (VstEvents *)&m_amevents, 0);
+
+  // the events point into their entries, free them once they are sent
+  for (unsigned int pos = start; pos != tail; pos++)
+    m_amring->entry[pos & (AMRINGCOUNT - 1)].seq.store(
+        pos + AMRINGCOUNT, std::memory_order_release);
+
+  atomic_store_explicit(&m_amring->tail, tail, std::memory_order_release);
+  atomic_store_explicit(&m_amdrain, 0, std::memory_order_release);
+}
+#endif
+
+#ifdef OUTEVENTS
+void RemotePluginClient::outEventsDeliver() {
+  int count = m_outevents->count;
+
+  if (count == 0)
+    return;
+
+  int sizeidx = 0;
+
+  for (int i = 0; i < count; i++) {
+    VstEvent *bsize = (VstEvent *)&m_outevents->data[sizeidx];
+#ifdef SYSEX
+    sizeidx += evlink(&m_outevents->data[sizeidx]);
+#else
+    sizeidx += bsize->byteSize + (2 * sizeof(VstInt32));
+#endif
+    m_outlist.events[i] = bsize;
+  }
+
+  m_outlist.numEvents = count;
+  m_outlist.reserved = 0;
+
+  if (theEffect)
+    m_audioMaster(theEffect, audioMasterProcessEvents, 0, 0,
+                  (VstEvents *)&m_outlist, 0);
+
+  m_outevents->count = 0;
+  m_outevents->size = 0;
+}
+#endif
+
 /*
 #ifdef EMBED
 void* RemotePluginClient::EMBEDThread()
@@ -597,13 +758,21 @@ m_threadbreakexitembed(0),
 */
 #endif
       m_threadinit(0), m_threadbreak(0), m_threadbreakexit(0), editopen(0),
-      m_shmFileName(0), m_shm(0), m_shmSize(0), m_shm2(0), m_shm3(0), m_shm4(0), m_shm5(0),
+      m_shmFileName(0), m_shm(0), m_shmSize(0), m_proclocked(0), m_parlocked(0), m_lockins(0),
+      m_lockouts(0), m_lockparams(0), m_shm2(0), m_shm3(0), m_shm4(0), m_shm5(0),
       m_shmControlFd(-1), m_shmControl(0), m_shmControlFileName(0),
       m_shmControl2(0), m_shmControl3(0), m_shmControl4(0), m_shmControl5(0), m_shmControl6(0),
       m_bufferSize(-1), m_numInputs(-1), m_numOutputs(-1), m_updateio(0),
       m_updatein(0), m_updateout(0), m_delay(0), timeInfo(0),
 #ifdef CHUNKBUF
       chunk_ptr(0),
+#ifdef CHUNKMAP
+      m_chunkmap(0), m_chunkmapsize(0),
+#endif
+#endif
+#ifdef CHUNKHASH
+      m_chunkgen(0), m_chunkconfirmed(-1), m_chunkeditor(0), m_chunksize(0),
+      m_chunkret(0), m_chunkhash(0),
 #endif
       m_inexcept(0), m_finishaudio(0), m_runok(0), m_syncok(0), m_386run(0),
       reaperid(0),
@@ -622,28 +791,69 @@ m_threadbreakexitembed(0),
       eventrun(0), eventstop(0),
 #endif
 #ifdef PCACHE
-     m_shm6(0),
+     m_shm6(0), m_shm6size(0), m_parcache(),
 #endif    
+#ifdef SPINWAIT
+      m_turnaround(0), m_spinbudget(0),
+#endif
+#ifdef AMRING
+      m_amring(0), m_amdrain(0),
+#endif
+#ifdef OUTEVENTS
+      m_outevents(0),
+#endif
+#ifdef PARBATCH
+      m_parbatch(0), m_namegen(1), m_displaygen(1), m_displaynext(-1),
+      m_displayseen(0),
+#ifdef ASYNCLOAD
+      m_loadseen(0),
+#endif
+#endif
+#ifdef PIPELINE
+      m_pipearea(0), m_pipeinflight(0), m_pipeframes(0), m_pipechannels(-1),
+      m_pipecap(0), m_piperead(0), m_pipewrite(0), m_pipeelsize(0),
+#endif
+#ifdef SCANCACHE
+      m_lazy(0), m_lazyopen(0), m_lazysamplerate(0), m_lazyblocksize(0),
+#endif
+#ifdef PARAMQUEUE
+      m_parqueuehead(0), m_parqueuetail(0), m_processthread(),
+      m_blockstart(0), m_sampleRate(0),
+#endif
       theEffect(0) {
   char tmpFileBase[60];
 
   srand(time(NULL));
 
-  sprintf(tmpFileBase, "/tmp/rplugin_shm_XXXXXX");
-  if (mkstemp(tmpFileBase) < 0) {
-    m_runok = 1;
-    cleanup();
-    return;
+#ifdef PARAMQUEUE
+  for (int i = 0; i < PARQUEUECOUNT; i++)
+    m_parqueue[i].seq.store(i, std::memory_order_relaxed);
+#endif
+
+  m_shmFd = syscall(SYS_memfd_create, "rplugin_shm", MFD_CLOEXEC);
+
+  if (m_shmFd >= 0) {
+    // the server opens the segment through our fd table, nothing is left
+    // behind if either side crashes
+    sprintf(tmpFileBase, "/proc/%d/fd/%d", getpid(), m_shmFd);
+    m_shmFileName = strdup(tmpFileBase);
+  } else {
+    sprintf(tmpFileBase, "/tmp/rplugin_shm_XXXXXX");
+    if (mkstemp(tmpFileBase) < 0) {
+      m_runok = 1;
+      cleanup();
+      return;
 //	throw((std::string)"Failed to obtain temporary filename");
-  }
-  m_shmFileName = strdup(tmpFileBase);
+    }
+    m_shmFileName = strdup(tmpFileBase);
 
-  m_shmFd = open(m_shmFileName, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-  if (m_shmFd < 0) {
-    m_runok = 1;
-    cleanup();
-    return;
+    m_shmFd = open(m_shmFileName, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (m_shmFd < 0) {
+      m_runok = 1;
+      cleanup();
+      return;
 //	 throw((std::string)"Failed to open or create shared memory file");
+    }
   }
 
   if (sizeShm()) {
@@ -655,6 +865,15 @@ m_threadbreakexitembed(0),
 }
 
 RemotePluginClient::~RemotePluginClient() {
+#ifdef STATS
+  printStats();
+#endif
+#ifdef SCANCACHE
+  // never started, there is no server or thread to wait for
+  if (m_lazy == 1)
+    cleanup();
+  else
+#endif
   if (m_runok == 0) {
     m_threadbreak = 1;
     waitForClientexit();
@@ -679,40 +898,51 @@ RemotePluginClient::~RemotePluginClient() {
 #ifdef CHUNKBUF
     if (chunk_ptr)
       free(chunk_ptr);
+#ifdef CHUNKMAP
+    if (m_chunkmap)
+      munmap(m_chunkmap, m_chunkmapsize);
+#endif
 #endif
   }
 }
 
+#ifdef STATS
+void RemotePluginClient::printStats() {
+  std::cerr << "LinVst3 client stats: wakes " << m_stats.wakesent
+            << " wakes skipped " << m_stats.wakeskipped << std::endl;
+#ifdef CHUNKHASH
+  std::cerr << "LinVst3 client stats: chunks sent " << m_stats.chunksent
+            << " chunks skipped " << m_stats.chunkskipped << std::endl;
+#endif
+}
+#endif
+
 void RemotePluginClient::syncStartup() {
-  int startok;
+  int state;
   int *ptr;
+  long long starttime = fstartms();
   
   m_shmControlptr = m_shmControl6;  
 
-  startok = 0;
-
   ptr = (int *)m_shm;
 
-  for (int i = 0; i < 400000; i++) {
-    if (*ptr == 490) {
-      startok = 1;
-      break;
-    }
-    usleep(100);
-  }
+  state = fstartwait(ptr, StartupNone, STARTUPTIMEOUT);
 
-  if (startok == 0) {
-    *ptr = 4;
+  if (state != StartupMapped) {
+    std::cerr << "LinVst3: server did not map the segment (state " << state
+              << ")" << std::endl;
+    fstartset(ptr, StartupClientTimeout);
     m_runok = 1;
     cleanup();
     return;
   }
 
   if (m_386run == 1) {
-    *ptr = 3;
+    state = StartupClientOk386;
   } else {
-    *ptr = 2;
+    state = StartupClientOk;
   }
+  fstartset(ptr, state);
 
   atomic_init(&m_shmControl->runServer, 0);
   atomic_init(&m_shmControl->runClient, 0);
@@ -767,28 +997,21 @@ void RemotePluginClient::syncStartup() {
 //    throw((std::string) "Failed to initialize thread");
   }
 
-  startok = 0;
-  
-  for (int i = 0; i < 400000; i++) { 
-     if (*ptr == 2001) {
-      break;
-    }     
+  state = fstartwait(ptr, state, STARTUPTIMEOUT);
 
-    if (*ptr == 2000) {
-      startok = 1;
-      break;
-    }
-    usleep(100);
-  }
-
-  *ptr = 6000;
+  fstartset(ptr, StartupClientAck);
 
-  if (startok == 0) {
+  if (state != StartupServerReady) {
+    std::cerr << "LinVst3: server failed to load the plugin (state " << state
+              << ")" << std::endl;
     m_runok = 1;
     cleanup();
     return;
   }
 
+  std::cerr << "LinVst3: server started in " << fstartms() - starttime
+            << " ms" << std::endl;
+
   /*
   #ifdef EMBED
       if(pthread_create(&m_EMBEDThread, NULL,
@@ -829,8 +1052,11 @@ void RemotePluginClient::cleanup() {
 
   #endif
   */
-  if (m_AMThread)
+  if (m_AMThread) {
+    if (m_shmControl)
+      fpost(m_shmControl, &m_shmControl->runServer);
     pthread_join(m_AMThread, NULL);
+  }
   /*
   #ifdef EMBED
              for(int i=0;i<5000;i++)
@@ -845,6 +1071,14 @@ void RemotePluginClient::cleanup() {
   #endif
   */
 
+#ifdef PCACHE
+  if (m_shm6) {
+    munmap(m_shm6, m_shm6size);
+    m_shm6 = 0;
+    m_parcache.count = 0;
+  }
+#endif
+
   if (m_shm) {
     munmap(m_shm, m_shmSize);
     m_shm = 0;
@@ -856,7 +1090,8 @@ void RemotePluginClient::cleanup() {
   }
 
   if (m_shmFileName) {
-    unlink(m_shmFileName);
+    if (strncmp(m_shmFileName, "/proc/", 6))
+      unlink(m_shmFileName);
     free(m_shmFileName);
     m_shmFileName = 0;
   }
@@ -865,12 +1100,50 @@ void RemotePluginClient::cleanup() {
 std::string RemotePluginClient::getFileIdentifiers() {
   std::string id;
 
-  id += m_shmFileName + strlen(m_shmFileName) - 6;
+  if (!strncmp(m_shmFileName, "/proc/", 6))
+    id += m_shmFileName;
+  else
+    id += m_shmFileName + strlen(m_shmFileName) - 6;
 
   //  std::cerr << "Returning file identifiers: " << id << std::endl;
   return id;
 }
 
+// Locks the part of the process area the current channel count and block
+// size use, and the parameter cache entries of the plugin. -1 keeps the
+// previous value.
+void RemotePluginClient::lockShm(int ins, int outs, int params) {
+  if (!m_shm)
+    return;
+
+  if (ins >= 0)
+    m_lockins = ins;
+  if (outs >= 0)
+    m_lockouts = outs;
+  if (params >= 0)
+    m_lockparams = params;
+
+#ifdef DOUBLEP
+  size_t elsize = sizeof(double);
+#else
+  size_t elsize = sizeof(float);
+#endif
+
+  size_t procsz = 0;
+
+  if (m_bufferSize > 0)
+    procsz = std::max(m_lockins, m_lockouts) * m_bufferSize * elsize;
+
+  flockrange(m_shm, &m_proclocked, procsz, PROCESSSIZE);
+
+#ifdef PCACHE
+  // the parameter cache is sized for the plugin, all of it is in use
+  if (m_shm6)
+    flockrange(m_shm6, &m_parlocked, m_lockparams > 0 ? m_shm6size : 0,
+               m_shm6size);
+#endif
+}
+
 int RemotePluginClient::sizeShm() {
   if (m_shm)
     return 0;
@@ -925,37 +1198,106 @@ int chunkrem;
 
     int chunksizecontrol = chunks * pagesize;
 
-#ifdef PCACHE
-    chunksize = PARCACHE;
+#ifdef AMRING
+    chunksize = sizeof(AMRing);
     chunks = chunksize / pagesize;
     chunkrem = chunksize % pagesize;
 
     if(chunkrem > 0)
     chunks += 1;
 
-    int parcachesize = chunks * pagesize;
+    int amringsize = chunks * pagesize;
+#endif
+
+#ifdef PARBATCH
+    chunksize = sizeof(BatchRequest);
+    chunks = chunksize / pagesize;
+    chunkrem = chunksize % pagesize;
+
+    if(chunkrem > 0)
+    chunks += 1;
+
+    int parbatchsize = chunks * pagesize;
+#endif
+
+#ifdef OUTEVENTS
+    chunksize = sizeof(OutEvents);
+    chunks = chunksize / pagesize;
+    chunkrem = chunksize % pagesize;
+
+    if(chunkrem > 0)
+    chunks += 1;
+
+    int outeventssize = chunks * pagesize;
+#endif
 
-  size_t sz = processsize + vsteventsprocess + chunksizemax + vsteventssend + (chunksizecontrol * 6) + parcachesize;
-#else
   size_t sz = processsize + vsteventsprocess + chunksizemax + vsteventssend + (chunksizecontrol * 6);
-#endif  
+
+#ifdef AMRING
+  size_t amringoffset = sz;
+  sz += amringsize;
+#endif
+#ifdef PARBATCH
+  size_t parbatchoffset = sz;
+  sz += parbatchsize;
+#endif
+#ifdef OUTEVENTS
+  size_t outeventsoffset = sz;
+  sz += outeventssize;
+#endif
+#ifdef PIPELINE
+  // a second event area, one is filled while the server reads the other
+  size_t pipeeventsoffset = sz;
+  sz += vsteventsprocess;
+#endif
+
+#ifdef HUGEPAGES
+  if (!strncmp(m_shmFileName, "/proc/", 6)) {
+    // hugetlb only works if huge pages are reserved, otherwise keep the
+    // normal memfd and ask for transparent huge pages below
+    size_t hugesz = ((sz + HUGEPAGESIZE - 1) / HUGEPAGESIZE) * HUGEPAGESIZE;
+    int hugefd = syscall(SYS_memfd_create, "rplugin_shm", MFD_CLOEXEC | MFD_HUGETLB);
+
+    if (hugefd >= 0) {
+      char *hugeshm = (char *)MAP_FAILED;
+
+      if (ftruncate(hugefd, hugesz) == 0)
+        hugeshm = (char *)mmap(0, hugesz, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, hugefd, 0);
+
+      if (hugeshm != MAP_FAILED) {
+        munmap(hugeshm, hugesz);
+        close(m_shmFd);
+        m_shmFd = hugefd;
+        char hugeFileBase[60];
+        sprintf(hugeFileBase, "/proc/%d/fd/%d", getpid(), m_shmFd);
+        free(m_shmFileName);
+        m_shmFileName = strdup(hugeFileBase);
+        sz = hugesz;
+      } else
+        close(hugefd);
+    }
+  }
+#endif
 
   ftruncate(m_shmFd, sz);
-  m_shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
-                       m_shmFd, 0);
-  if (!m_shm) {
+  m_shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, m_shmFd, 0);
+  if (m_shm == MAP_FAILED) {
     std::cerr
         << "RemotePluginClient::sizeShm: ERROR: mmap or mremap failed for "
         << sz << " bytes from fd " << m_shmFd << "!" << std::endl;
+    m_shm = 0;
     m_shmSize = 0;
     return 1;
   } else {
-    madvise(m_shm, sz, MADV_SEQUENTIAL | MADV_WILLNEED | MADV_DONTFORK);
-    memset(m_shm, 0, sz);
+    // madvise advice values are not flags, they can not be or'ed together
+    madvise(m_shm, sz, MADV_DONTFORK);
+#ifdef HUGEPAGES
+    madvise(m_shm, processsize + vsteventsprocess, MADV_HUGEPAGE);
+#endif
+    // a new memfd or tmp file reads as zeros, touching all of it would
+    // allocate the whole segment
     m_shmSize = sz;
-
-    if (mlock(m_shm, sz) != 0)
-      perror("mlock fail1");
   }
 
   m_shm2 = &m_shm[processsize];
@@ -963,9 +1305,36 @@ int chunkrem;
   m_shm4 = &m_shm[processsize + vsteventsprocess + chunksizemax];
   m_shm5 = &m_shm[processsize + vsteventsprocess + chunksizemax + vsteventssend];
 
-#ifdef PCACHE
-  m_shm6 = &m_shm[processsize + vsteventsprocess + chunksizemax + vsteventssend + (chunksizecontrol * 6)];
-#endif  
+#ifdef AMRING
+  m_amring = (AMRing *)&m_shm[amringoffset];
+  for (int i = 0; i < AMRINGCOUNT; i++)
+    m_amring->entry[i].seq.store(i, std::memory_order_relaxed);
+#endif
+#ifdef PARBATCH
+  m_parbatch = (BatchRequest *)&m_shm[parbatchoffset];
+#endif
+#ifdef OUTEVENTS
+  m_outevents = (OutEvents *)&m_shm[outeventsoffset];
+#endif
+#ifdef PIPELINE
+  m_pipeevents[0] = m_shm2;
+  m_pipeevents[1] = &m_shm[pipeeventsoffset];
+#endif
+
+  // the process area and parameter cache are locked by lockShm() as the
+  // configuration becomes known, these are always used
+  if (mlock(m_shm2, vsteventsprocess) != 0)
+    perror("mlock fail1");
+#ifdef PIPELINE
+  if (mlock(m_pipeevents[1], vsteventsprocess) != 0)
+    perror("mlock fail1");
+#endif
+  if (mlock(m_shm5, chunksizecontrol * 6) != 0)
+    perror("mlock fail1");
+#ifdef AMRING
+  if (mlock(m_amring, amringsize) != 0)
+    perror("mlock fail1");
+#endif
 
   m_shmControl = (ShmControl *)m_shm5;
 //  memset(m_shmControl, 0, sizeof(ShmControl));
@@ -1028,14 +1397,38 @@ void RemotePluginClient::setBufferSize(int s) {
   if (s == m_bufferSize)
     return;
 
+#ifdef PIPELINE
+  std::lock_guard<std::mutex> pipelock(m_pipelock);
+  pipeWait();
+  int oldsize = m_bufferSize;
+#endif
+
   m_bufferSize = s;
 
   m_shmControlptr->ropcode = RemotePluginSetBufferSize;
   m_shmControlptr->value = s;
   waitForServer(m_shmControlptr);
+
+  lockShm(-1, -1, -1);
+
+#ifdef PIPELINE
+  // the pipeline adds one buffer of latency
+  if (theEffect) {
+    theEffect->initialDelay = m_delay + s;
+    if ((oldsize > 0) && m_audioMaster)
+      m_audioMaster(theEffect, audioMasterIOChanged, 0, 0, 0, 0);
+  }
+#endif
 }
 
 void RemotePluginClient::setSampleRate(int s) {
+#ifdef PIPELINE
+  std::lock_guard<std::mutex> pipelock(m_pipelock);
+  pipeWait();
+#endif
+#ifdef PARAMQUEUE
+  m_sampleRate = s;
+#endif
   m_shmControlptr->ropcode = RemotePluginSetSampleRate;
   m_shmControlptr->value = s;
   waitForServer(m_shmControlptr);
@@ -1048,6 +1441,14 @@ void RemotePluginClient::terminate() { return; }
 int RemotePluginClient::getEffInt(int opcode, int value) {
   int retval;
 
+#ifdef PIPELINE
+  std::lock_guard<std::mutex> pipelock(m_pipelock);
+  pipeWait();
+  // a plugin that is switched off and on starts from silence
+  if (opcode == effMainsChanged)
+    m_pipechannels = -1;
+#endif
+
   m_shmControl3->ropcode = RemotePluginGetEffInt;
   m_shmControl3->opcode = opcode;
   m_shmControl3->value = value;
@@ -1071,6 +1472,18 @@ std::string RemotePluginClient::getEffString(int opcode, int index) {
 std::string RemotePluginClient::getParameterName(int p) {
   char retval[512];
 
+#ifdef PMETA
+  ParamMeta meta;
+  if (metaCached(p, &meta))
+    return meta.name;
+#endif
+
+#ifdef PARBATCH
+  ParamInfo *info = paramInfo(p, false);
+  if (info)
+    return info->name;
+#endif
+
   m_shmControlptr->ropcode = RemotePluginGetParameterName;
   m_shmControlptr->value = p;
   waitForServer(m_shmControlptr);
@@ -1082,6 +1495,18 @@ std::string RemotePluginClient::getParameterName(int p) {
 std::string RemotePluginClient::getParameterLabel(int p) {
   char retval[512];
 
+#ifdef PMETA
+  ParamMeta meta;
+  if (metaCached(p, &meta))
+    return meta.label;
+#endif
+
+#ifdef PARBATCH
+  ParamInfo *info = paramInfo(p, false);
+  if (info)
+    return info->label;
+#endif
+
   m_shmControlptr->ropcode = RemotePluginGetParameterLabel;
   m_shmControlptr->value = p;
   waitForServer(m_shmControlptr);
@@ -1093,6 +1518,31 @@ std::string RemotePluginClient::getParameterLabel(int p) {
 std::string RemotePluginClient::getParameterDisplay(int p) {
   char retval[512];
 
+#ifdef PDISPLAY
+  if (displayCached(p, retval))
+    return retval;
+
+#ifdef PARBATCH
+  // the slot is stale, so is the batch cache. A batch read still fills
+  // the server slots of the parameters the host asks for next.
+  if (paramInfo(p, false)) {
+    int block = PARBATCHCOUNT / 4;
+    int count = (p == m_displaynext)
+                    ? std::min(block, theEffect->numParams - p) : 1;
+
+    paramFetch(p, count, false, m_namegen, m_displaygen);
+    m_displaynext = p + 1;
+    return m_parinfo[p].display;
+  }
+#endif
+#else
+#ifdef PARBATCH
+  ParamInfo *info = paramInfo(p, true);
+  if (info)
+    return info->display;
+#endif
+#endif
+
   m_shmControlptr->ropcode = RemotePluginGetParameterDisplay;
   m_shmControlptr->value = p;
   waitForServer(m_shmControlptr);
@@ -1101,6 +1551,167 @@ std::string RemotePluginClient::getParameterDisplay(int p) {
   return retval;
 }
 
+#ifdef PDISPLAY
+// Hosts poll the display of every visible parameter. The server keeps the
+// strings in the parameter cache until the value changes, a valid one is
+// read here without a round trip.
+bool RemotePluginClient::displayCached(int p, char *text) {
+  if (p < 0 || p >= m_parcache.count)
+    return false;
+
+  ParamDisplay *slot = &m_parcache.display[p];
+  int seq = slot->seq.load(std::memory_order_acquire);
+
+  if (seq & 1)
+    return false;
+  if (slot->filled.load(std::memory_order_relaxed) !=
+      slot->inval.load(std::memory_order_acquire) + 1)
+    return false;
+
+  memcpy(text, slot->text, PDISPLAYLEN);
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (slot->seq.load(std::memory_order_relaxed) != seq)
+    return false;
+
+  text[PDISPLAYLEN - 1] = '\0';
+  return true;
+}
+#endif
+
+#ifdef PMETA
+// The server publishes the names, labels and properties of all parameters
+// once they are known. An entry read while the table is rebuilt is
+// dropped and the query goes to the server.
+bool RemotePluginClient::metaCached(int p, ParamMeta *meta) {
+  if (p < 0 || p >= m_parcache.count)
+    return false;
+
+  int seq = m_parcache.metaseq->load(std::memory_order_acquire);
+
+  if (seq == 0 || (seq & 1))
+    return false;
+
+  memcpy(meta, &m_parcache.meta[p], sizeof(ParamMeta));
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (m_parcache.metaseq->load(std::memory_order_relaxed) != seq)
+    return false;
+
+  meta->name[PMETANAMELEN - 1] = '\0';
+  meta->label[PMETALABELLEN - 1] = '\0';
+  return true;
+}
+#endif
+
+#ifdef PARBATCH
+// Hosts query name, label, display and canBeAutomated for every parameter
+// when a project opens. Misses fetch a whole block of parameters in one
+// RemotePluginBatch round trip and the results are kept until invalidated.
+RemotePluginClient::ParamInfo *RemotePluginClient::paramInfo(int p,
+                                                             bool display) {
+  if (!theEffect || p < 0 || p >= theEffect->numParams)
+    return 0;
+
+  int numparams = theEffect->numParams;
+
+  if ((int)m_parinfo.size() != numparams)
+    m_parinfo.assign(numparams, ParamInfo());
+
+#ifdef ASYNCLOAD
+  // a state load started or finished on the server since the last query
+  int loadstatus = m_shmControl3->loadstatus.load(std::memory_order_acquire);
+  if (loadstatus != m_loadseen) {
+    m_loadseen = loadstatus;
+    paramInvalidate(true);
+  }
+#endif
+
+  // a display read before the server applied a value the host set is stale
+  int displayseen = m_shmControl3->displaygen.load(std::memory_order_acquire);
+  if (displayseen != m_displayseen) {
+    m_displayseen = displayseen;
+    paramInvalidate(false);
+  }
+
+  ParamInfo *info = &m_parinfo[p];
+  int namegen = m_namegen;
+  int displaygen = m_displaygen;
+  int block = PARBATCHCOUNT / 4;
+
+  if (info->namegen != namegen) {
+    int start = p - (p % block);
+    paramFetch(start, std::min(block, numparams - start), true, namegen,
+               displaygen);
+  } else if (display && info->displaygen != displaygen) {
+    // only read ahead while the host is walking through the parameters
+    if (p == m_displaynext)
+      paramFetch(p, std::min(block, numparams - p), false, namegen,
+                 displaygen);
+    else
+      paramFetch(p, 1, false, namegen, displaygen);
+  }
+
+  if (display)
+    m_displaynext = p + 1;
+
+  return info;
+}
+
+void RemotePluginClient::paramFetch(int start, int count, bool names,
+                                    int namegen, int displaygen) {
+  int ops = names ? 4 : 1;
+  int n = 0;
+
+  for (int i = 0; i < count; i++) {
+    BatchEntry *entry = &m_parbatch->entry[n];
+
+    if (names) {
+      entry[0].ropcode = RemotePluginGetParameterName;
+      entry[1].ropcode = RemotePluginGetParameterLabel;
+      entry[2].ropcode = RemotePluginCanBeAutomated;
+      entry[3].ropcode = RemotePluginGetParameterDisplay;
+    } else
+      entry[0].ropcode = RemotePluginGetParameterDisplay;
+
+    for (int j = 0; j < ops; j++)
+      entry[j].value = start + i;
+    n += ops;
+  }
+
+  m_parbatch->count = n;
+  m_shmControlptr->ropcode = RemotePluginBatch;
+  waitForServer(m_shmControlptr);
+
+  n = 0;
+
+  for (int i = 0; i < count; i++) {
+    ParamInfo *info = &m_parinfo[start + i];
+    BatchEntry *entry = &m_parbatch->entry[n];
+
+    if (names) {
+      info->name = entry[0].retstr;
+      info->label = entry[1].retstr;
+      info->automate = entry[2].retint;
+      info->display = entry[3].retstr;
+      info->namegen = namegen;
+    } else
+      info->display = entry[0].retstr;
+
+    info->displaygen = displaygen;
+    n += ops;
+  }
+}
+
+// displays go stale whenever a value may have changed, names and labels
+// only on program, chunk, io or display updates
+void RemotePluginClient::paramInvalidate(bool names) {
+  if (names)
+    m_namegen++;
+  m_displaygen++;
+}
+#endif
+
 int RemotePluginClient::getParameterCount() {
   int retval;
 
@@ -1111,9 +1722,60 @@ int RemotePluginClient::getParameterCount() {
   m_shmControl3->ropcode = RemotePluginGetParameterCount;
   waitForServer(m_shmControl3);
   retval = m_shmControl3->retint;
+#ifdef PCACHE
+  if (!m_shm6 && retval > 0)
+    parCacheCreate(retval);
+#endif
+  lockShm(-1, -1, retval);
   return retval;
 }
 
+#ifdef PCACHE
+// Creates the parameter cache for count parameters and has the server map
+// and fill it. The host only uses the count it got here, so the cache is
+// never resized. Without a cache parameters read as 0 and are not set.
+void RemotePluginClient::parCacheCreate(int count) {
+  char tmpFileBase[60];
+  size_t sz = pcachesize(count);
+  int fd = syscall(SYS_memfd_create, "rplugin_par", MFD_CLOEXEC);
+
+  if (fd >= 0)
+    sprintf(tmpFileBase, "/proc/%d/fd/%d", getpid(), fd);
+  else {
+    sprintf(tmpFileBase, "/tmp/rplugin_par_XXXXXX");
+    fd = mkstemp(tmpFileBase);
+    if (fd < 0)
+      return;
+  }
+
+  char *shm = (char *)MAP_FAILED;
+  if (ftruncate(fd, sz) == 0)
+    shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (shm != MAP_FAILED) {
+    madvise(shm, sz, MADV_DONTFORK);
+    m_shmControl3->ropcode = RemotePluginParCache;
+    m_shmControl3->value = count;
+    strcpy(m_shmControl3->retstr, tmpFileBase);
+    waitForServer(m_shmControl3);
+
+    if (m_shmControl3->retint == 1) {
+      m_shm6 = shm;
+      m_shm6size = sz;
+      pcachelayout(m_shm6, count, &m_parcache);
+    } else {
+      std::cerr << "RemotePluginClient: parameter cache not mapped by server"
+                << std::endl;
+      munmap(shm, sz);
+    }
+  }
+
+  if (strncmp(tmpFileBase, "/proc/", 6))
+    unlink(tmpFileBase);
+  close(fd);
+}
+#endif
+
 void RemotePluginClient::setParameter(int p, float v) {
   ShmControl *m_shmControlptr4;
   m_shmControlptr4 = m_shmControl4;
@@ -1121,17 +1783,30 @@ void RemotePluginClient::setParameter(int p, float v) {
   if (m_inexcept == 1 || m_finishaudio == 1) {
     return;
   }
+
+#ifdef PARBATCH
+  paramInvalidate(false);
+#endif
+#ifdef CHUNKHASH
+  chunkInvalidate();
+#endif
   
 #ifdef PCACHE
-  ParamState* pstate = (ParamState*)m_shm6; 
-
-  if(p < 10000)
-  { 
-  if(pstate[p].value != v)
-  {      
-  pstate[p].changed = 1;
-  pstate[p].valueupdate = v;  
-  }
+  // a pending value counts as well as the applied one, a host that sets a
+  // value back before the next block must not lose that
+  if (p >= 0 && p < m_parcache.count) {
+    if (m_parcache.value[p] != v || m_parcache.update[p] != v) {
+      m_parcache.update[p] = v;
+#ifdef PDISPLAY
+      pdisplayinval(&m_parcache, p);
+#endif
+#ifdef PARAMQUEUE
+      // a full queue falls back to the cache, applied at offset 0
+      if (parQueuePush(p, v))
+        return;
+#endif
+      pdirtyset(&m_parcache, p);
+    }
   }
 #else  
   m_shmControlptr4->ropcode = RemotePluginSetParameter;
@@ -1141,6 +1816,79 @@ void RemotePluginClient::setParameter(int p, float v) {
 #endif  
 }
 
+#ifdef PARAMQUEUE
+// Queues a change for the next block. Changes made on the process thread
+// come before the block and go at offset 0. Changes from other threads get
+// the time since the last block was sent as their offset, so they keep
+// their spacing one block later instead of all landing on the first sample.
+bool RemotePluginClient::parQueuePush(int p, float v) {
+  int offset = 0;
+
+  if (!pthread_equal(pthread_self(), m_processthread) && m_sampleRate > 0) {
+    long long elapsed = fnanotime() - m_blockstart.load();
+    if (elapsed > 1000000000LL)
+      elapsed = 1000000000LL;
+    if (elapsed > 0)
+      offset = (int)(elapsed * m_sampleRate / 1000000000LL);
+  }
+
+  // a slot is claimed with a CAS on head, the audio thread never waits
+  unsigned int pos = m_parqueuehead.load(std::memory_order_relaxed);
+  ParamSlot *slot;
+
+  for (;;) {
+    slot = &m_parqueue[pos & (PARQUEUECOUNT - 1)];
+    int dif = (int)(slot->seq.load(std::memory_order_acquire) - pos);
+
+    if (dif == 0) {
+      if (m_parqueuehead.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+        break;
+    } else if (dif < 0)
+      return false;
+    else
+      pos = m_parqueuehead.load(std::memory_order_relaxed);
+  }
+
+  slot->change.index = p;
+  slot->change.offset = offset;
+  slot->change.value = v;
+  slot->seq.store(pos + 1, std::memory_order_release);
+
+  return true;
+}
+
+// moves the queued changes to the process event area for the block being
+// sent, offsets past its end go on its last sample
+void RemotePluginClient::parQueueShip(int sampleFrames) {
+  ParamQueue *queue = pqueue(m_shm2);
+
+  int count = 0;
+
+  // a change still being written and the ones after it wait for the next
+  // block
+  for (;;) {
+    ParamSlot *slot = &m_parqueue[m_parqueuetail & (PARQUEUECOUNT - 1)];
+
+    if (slot->seq.load(std::memory_order_acquire) != m_parqueuetail + 1)
+      break;
+
+    queue->entry[count] = slot->change;
+    if (queue->entry[count].offset >= sampleFrames)
+      queue->entry[count].offset = sampleFrames - 1;
+    count++;
+
+    slot->seq.store(m_parqueuetail + PARQUEUECOUNT, std::memory_order_release);
+    m_parqueuetail++;
+  }
+
+  queue->count = count;
+
+  m_processthread = pthread_self();
+  m_blockstart = fnanotime();
+}
+#endif
+
 float RemotePluginClient::getParameter(int p) {
   ShmControl *m_shmControlptr5;
   m_shmControlptr5 = m_shmControl5;
@@ -1152,11 +1900,9 @@ float RemotePluginClient::getParameter(int p) {
   }
 
 #ifdef PCACHE
-  if(p < 10000)
-  {    
-  ParamState* pstate = (ParamState*)m_shm6;        
-  return pstate[p].value;
-  }
+  if (p >= 0 && p < m_parcache.count)
+    return m_parcache.value[p];
+  return 0;
 #else
   m_shmControlptr5->ropcode = RemotePluginGetParameter;
   m_shmControlptr5->value = p;
@@ -1166,7 +1912,14 @@ float RemotePluginClient::getParameter(int p) {
 #endif  
 }
 
-float RemotePluginClient::getParameterDefault(int p) { return 0.0; }
+float RemotePluginClient::getParameterDefault(int p) {
+#ifdef PMETA
+  ParamMeta meta;
+  if (metaCached(p, &meta))
+    return meta.defvalue;
+#endif
+  return 0.0;
+}
 
 void RemotePluginClient::getParameters(int p0, int pn, float *v) { return; }
 
@@ -1181,6 +1934,135 @@ void RemotePluginClient::waitForServer(ShmControl *m_shmControlptr3) {
   m_shmControlptr3->ropcode = RemotePluginNoOpcode;
 }
 
+void RemotePluginClient::waitForServerProcess(ShmControl *m_shmControlptr3) {
+#ifdef SPINWAIT
+  m_shmControlptr3->posttime = fnanotime();
+  fpost2(m_shmControlptr3, &m_shmControlptr3->runServer);
+
+  if (!fspin(&m_shmControlptr3->runClient, m_spinbudget)) {
+    if (fwait2(m_shmControlptr3, &m_shmControlptr3->runClient, 60000)) {
+      if (m_inexcept == 0)
+        RemotePluginClosedException();
+    }
+  }
+
+  // only the server's own time counts, a futex wake after a miss would
+  // otherwise keep the budget at nothing for good
+  m_spinbudget = fspinbudget(&m_turnaround, m_shmControlptr3->proctime);
+
+  m_shmControlptr3->ropcode = RemotePluginNoOpcode;
+#else
+  waitForServer(m_shmControlptr3);
+#endif
+}
+
+#ifdef PIPELINE
+// Pipelined processing: process() posts block N and returns without
+// waiting, the host gets output that is one buffer late from the fifo.
+// Block N is collected at the start of the next process() call, or by
+// anything that needs the audio thread of the server to be idle. The
+// caller holds m_pipelock.
+void RemotePluginClient::pipeWait() {
+  if (!std::atomic_exchange(&m_pipeinflight, 0))
+    return;
+
+  if (fwait2(m_shmControl2, &m_shmControl2->runClient, 60000)) {
+    if (m_inexcept == 0)
+      RemotePluginClosedException();
+  }
+
+  m_shmControl2->ropcode = RemotePluginNoOpcode;
+
+  // the next block overwrites the process area, keep the outputs
+  size_t blocksz = m_pipeframes * m_pipeelsize;
+  size_t capsz = m_pipecap * m_pipeelsize;
+  size_t writepos = m_pipewrite * m_pipeelsize;
+  size_t first = std::min(blocksz, capsz - writepos);
+
+  for (int i = 0; i < m_pipechannels; ++i) {
+    char *fifo = &m_pipefifo[i * capsz];
+    memcpy(&fifo[writepos], m_shm + i * blocksz, first);
+    memcpy(fifo, m_shm + i * blocksz + first, blocksz - first);
+  }
+
+  m_pipewrite = (m_pipewrite + m_pipeframes) % m_pipecap;
+}
+
+// the fifo starts with one buffer of silence, that is the added latency
+void RemotePluginClient::pipeReset(int channels, size_t elsize) {
+  m_pipechannels = channels;
+  m_pipeelsize = elsize;
+  m_pipecap = m_bufferSize * 2;
+  m_pipefifo.assign(m_pipechannels * m_pipecap * m_pipeelsize, 0);
+  m_piperead = 0;
+  m_pipewrite = m_bufferSize;
+}
+
+void RemotePluginClient::pipePost(void **outputs, int offset,
+                                  int sampleFrames, int ropcode,
+                                  size_t elsize) {
+  if ((m_pipechannels != m_numOutputs) || (m_pipeelsize != elsize) ||
+      (m_pipecap != m_bufferSize * 2))
+    pipeReset(m_numOutputs, elsize);
+
+  m_shmControl2->ropcode = (RemotePluginOpcode)ropcode;
+  m_shmControl2->value2 = sampleFrames;
+  m_shmControl2->value3 = m_pipearea;
+
+  m_pipeframes = sampleFrames;
+  m_pipeinflight = 1;
+
+#ifdef SPINWAIT
+  m_shmControl2->posttime = fnanotime();
+#endif
+  fpost2(m_shmControl2, &m_shmControl2->runServer);
+
+  // events for the next block go to the other area
+  m_pipearea ^= 1;
+  m_shm2 = m_pipeevents[m_pipearea];
+
+  size_t blocksz = sampleFrames * m_pipeelsize;
+  size_t capsz = m_pipecap * m_pipeelsize;
+  size_t readpos = m_piperead * m_pipeelsize;
+  size_t first = std::min(blocksz, capsz - readpos);
+
+  for (int i = 0; i < m_pipechannels; ++i) {
+    char *fifo = &m_pipefifo[i * capsz];
+    char *output = (char *)outputs[i] + offset * m_pipeelsize;
+    memcpy(output, &fifo[readpos], first);
+    memcpy(output + first, fifo, blocksz - first);
+  }
+
+  m_piperead = (m_piperead + sampleFrames) % m_pipecap;
+}
+
+// Blocks longer than the buffer size go through in pieces of at most one
+// buffer so the latency stays the same. Events and parameter changes go
+// with the first piece.
+void RemotePluginClient::pipeProcess(void **inputs, void **outputs,
+                                     int sampleFrames, int ropcode,
+                                     size_t elsize) {
+  for (int done = 0; done < sampleFrames;) {
+    int frames = std::min(sampleFrames - done, m_bufferSize);
+    size_t blocksz = frames * elsize;
+
+    if (done > 0)
+      pipeWait();
+
+    for (int i = 0; i < m_numInputs; ++i)
+      memcpy(m_shm + i * blocksz, (char *)inputs[i] + done * elsize, blocksz);
+
+#ifdef PARAMQUEUE
+    if (done == 0)
+      parQueueShip(frames);
+#endif
+
+    pipePost(outputs, done, frames, ropcode, elsize);
+    done += frames;
+  }
+}
+#endif
+
 void RemotePluginClient::waitForServer2exit() {
   fpost(m_shmControl2, &m_shmControl2->runServer);
   fpost(m_shmControl2, &m_shmControl2->runClient);
@@ -1230,12 +2112,31 @@ void RemotePluginClient::process(float **inputs, float **outputs,
     return;
   }
 
+#ifdef PIPELINE
+  std::unique_lock<std::mutex> pipelock(m_pipelock, std::try_to_lock);
+
+  // another thread has the audio thread of the server, this block is silent
+  if (!pipelock.owns_lock()) {
+    for (int i = 0; i < m_numOutputs; ++i)
+      memset(outputs[i], 0, sampleFrames * sizeof(float));
+    return;
+  }
+
+  pipeWait();
+#ifdef OUTEVENTS
+  outEventsDeliver();
+#endif
+#endif
+
   if (m_updateio == 1) {
     m_numInputs = m_updatein;
     m_numOutputs = m_updateout;
     m_shmControlptr2->ropcode = RemotePluginProcess;
     m_shmControlptr2->value2 = -1;
-    waitForServer(m_shmControlptr2);
+#ifdef PIPELINE
+    m_shmControlptr2->value3 = m_pipearea;
+#endif
+    waitForServerProcess(m_shmControlptr2);
     m_updateio = 0;
     return;
   }
@@ -1265,6 +2166,15 @@ void RemotePluginClient::process(float **inputs, float **outputs,
   }
 #endif
 
+#ifdef PIPELINE
+  pipeProcess((void **)inputs, (void **)outputs, sampleFrames, RemotePluginProcess,
+              sizeof(float));
+#ifdef AMRING
+  amDrain();
+#endif
+  return;
+#endif
+
   size_t blocksz = sampleFrames * sizeof(float);
 
   if (m_numInputs > 0) {
@@ -1272,15 +2182,26 @@ void RemotePluginClient::process(float **inputs, float **outputs,
       memcpy(m_shm + i * blocksz, inputs[i], blocksz);
   }
 
+#ifdef PARAMQUEUE
+  parQueueShip(sampleFrames);
+#endif
+
   m_shmControlptr2->ropcode = RemotePluginProcess;
   m_shmControlptr2->value2 = sampleFrames;
 
-  waitForServer(m_shmControlptr2);
+  waitForServerProcess(m_shmControlptr2);
 
   if (m_numOutputs > 0) {
     for (int i = 0; i < m_numOutputs; ++i)
       memcpy(outputs[i], m_shm + i * blocksz, blocksz);
   }
+
+#ifdef OUTEVENTS
+  outEventsDeliver();
+#endif
+#ifdef AMRING
+  amDrain();
+#endif
   return;
 }
 
@@ -1304,12 +2225,31 @@ void RemotePluginClient::processdouble(double **inputs, double **outputs,
     return;
   }
 
+#ifdef PIPELINE
+  std::unique_lock<std::mutex> pipelock(m_pipelock, std::try_to_lock);
+
+  // another thread has the audio thread of the server, this block is silent
+  if (!pipelock.owns_lock()) {
+    for (int i = 0; i < m_numOutputs; ++i)
+      memset(outputs[i], 0, sampleFrames * sizeof(double));
+    return;
+  }
+
+  pipeWait();
+#ifdef OUTEVENTS
+  outEventsDeliver();
+#endif
+#endif
+
   if (m_updateio == 1) {
     m_numInputs = m_updatein;
     m_numOutputs = m_updateout;
     m_shmControlptr2->ropcode = RemotePluginProcessDouble;
     m_shmControlptr2->value2 = -1;
-    waitForServer(m_shmControlptr2);
+#ifdef PIPELINE
+    m_shmControlptr2->value3 = m_pipearea;
+#endif
+    waitForServerProcess(m_shmControlptr2);
     m_updateio = 0;
     return;
   }
@@ -1339,6 +2279,15 @@ void RemotePluginClient::processdouble(double **inputs, double **outputs,
   }
 #endif
 
+#ifdef PIPELINE
+  pipeProcess((void **)inputs, (void **)outputs, sampleFrames, RemotePluginProcessDouble,
+              sizeof(double));
+#ifdef AMRING
+  amDrain();
+#endif
+  return;
+#endif
+
   size_t blocksz = sampleFrames * sizeof(double);
 
   if (m_numInputs > 0) {
@@ -1346,15 +2295,26 @@ void RemotePluginClient::processdouble(double **inputs, double **outputs,
       memcpy(m_shm + i * blocksz, inputs[i], blocksz);
   }
 
+#ifdef PARAMQUEUE
+  parQueueShip(sampleFrames);
+#endif
+
   m_shmControlptr2->ropcode = RemotePluginProcessDouble;
   m_shmControlptr2->value2 = sampleFrames;
 
-  waitForServer(m_shmControlptr2);
+  waitForServerProcess(m_shmControlptr2);
 
   if (m_numOutputs > 0) {
     for (int i = 0; i < m_numOutputs; ++i)
       memcpy(outputs[i], m_shm + i * blocksz, blocksz);
   }
+
+#ifdef OUTEVENTS
+  outEventsDeliver();
+#endif
+#ifdef AMRING
+  amDrain();
+#endif
   return;
 }
 
@@ -1390,6 +2350,14 @@ int RemotePluginClient::processVstEvents(VstEvents *evnts) {
   eventnum2 = 0;  
   sizeidx = sizeof(int);
 
+#ifdef SYSEX
+#ifdef PARAMQUEUE
+  int evlimit = VSTEVENTS_PROCESS - sizeof(ParamQueue);
+#else
+  int evlimit = VSTEVENTS_PROCESS;
+#endif
+#endif
+
  // if (eventnum > VSTSIZE)
  //   eventnum = VSTSIZE;
 
@@ -1397,13 +2365,36 @@ int RemotePluginClient::processVstEvents(VstEvents *evnts) {
     VstEvent *pEvent = evnts->events[i];
 
     if (pEvent->type == kVstSysExType) {
+#ifdef SYSEX
+      if (sizeidx + evpackedsize(pEvent) > evlimit)
+        continue;
+#ifdef CHUNKHASH
+      chunkInvalidate();
+#endif
+      sizeidx += evpack(&m_shm2[sizeidx], pEvent);
+      eventnum2++;
+#endif
     continue;
     } else {
+#ifdef CHUNKHASH
+      // controllers and program changes may change the plugin state
+      if (pEvent->type == kVstMidiType) {
+        int status = ((VstMidiEvent *)pEvent)->midiData[0] & 0xf0;
+        if (status == 0xb0 || status == 0xc0)
+          chunkInvalidate();
+      }
+#endif
       unsigned int size = (2 * sizeof(VstInt32)) + evnts->events[i]->byteSize;
       memcpy(&m_shm2[sizeidx], evnts->events[i], size);
       sizeidx += size;
+#ifdef PARAMQUEUE
+      // the end of the area holds the parameter queue
+      if((sizeidx) >= (int)(VSTEVENTS_PROCESS - sizeof(ParamQueue)))
+      break;   
+#else
       if((sizeidx) >= VSTEVENTS_PROCESS)
       break;   
+#endif
       eventnum2++;   
     }
   }
@@ -1419,6 +2410,18 @@ int RemotePluginClient::processVstEvents(VstEvents *evnts) {
 
   m_shmControlptr2 = m_shmControl2;
 
+#ifdef PIPELINE
+  std::unique_lock<std::mutex> pipelock(m_pipelock, std::try_to_lock);
+
+  if (!pipelock.owns_lock()) {
+    *ptr = 0;
+    return ret;
+  }
+
+  pipeWait();
+  m_shmControlptr2->value3 = m_pipearea;
+#endif
+
   m_shmControlptr2->ropcode = RemotePluginProcessEvents;
   waitForServer2(m_shmControlptr2);
   ret = m_shmControlptr2->retint;  
@@ -1549,6 +2552,10 @@ void RemotePluginClient::setDebugLevel(RemotePluginDebugLevel level) { return; }
 bool RemotePluginClient::warn(std::string str) { return false; }
 
 void RemotePluginClient::showGUI() {
+#ifdef CHUNKHASH
+  m_chunkeditor = 1;
+  chunkInvalidate();
+#endif
 #ifdef EMBED
   memcpy(m_shmControl3->wret, winm, sizeof(winmessage));
 #endif
@@ -1562,10 +2569,18 @@ void RemotePluginClient::showGUI() {
 void RemotePluginClient::hideGUI() {
   m_shmControl3->ropcode = RemotePluginHideGUI;
   waitForServer(m_shmControl3);
+#ifdef CHUNKHASH
+  m_chunkeditor = 0;
+  chunkInvalidate();
+#endif
 }
 
 #ifdef EMBED
 void RemotePluginClient::openGUI() {
+#ifdef CHUNKHASH
+  m_chunkeditor = 1;
+  chunkInvalidate();
+#endif
   m_shmControl3->ropcode = RemotePluginOpenGUI;
   waitForServer(m_shmControl3);
 }
@@ -1604,6 +2619,10 @@ void RemotePluginClient::effVoidOp(int opcode) {
     m_shmControl3->ropcode = RemotePluginDoVoid;
     m_shmControl3->opcode = opcode;
   } else if (opcode == effClose) {
+#ifdef PIPELINE
+    std::lock_guard<std::mutex> pipelock(m_pipelock);
+    pipeWait();
+#endif
     waitForClientexit();
     m_threadbreak = 1;
     /*
@@ -1641,6 +2660,10 @@ void RemotePluginClient::effVoidOp(int opcode) {
     waitForServer5exit();
     waitForServer6exit();
   } else {
+#ifdef PIPELINE
+    std::lock_guard<std::mutex> pipelock(m_pipelock);
+    pipeWait();
+#endif
     m_shmControlptr->ropcode = RemotePluginDoVoid;
     m_shmControlptr->opcode = opcode;
     waitForServer(m_shmControlptr);
@@ -1664,6 +2687,18 @@ int RemotePluginClient::effVoidOp2(int opcode, int index, int value,
 int RemotePluginClient::canBeAutomated(int param) {
   int retval;
 
+#ifdef PMETA
+  ParamMeta meta;
+  if (metaCached(param, &meta))
+    return meta.automate;
+#endif
+
+#ifdef PARBATCH
+  ParamInfo *info = paramInfo(param, false);
+  if (info)
+    return info->automate;
+#endif
+
   m_shmControlptr->ropcode = RemotePluginCanBeAutomated;
   m_shmControlptr->value = param;
   waitForServer(m_shmControlptr);
@@ -1707,6 +2742,10 @@ int RemotePluginClient::getinitialDelay() {
   waitForServer(m_shmControl3);
   retval = m_shmControl3->retint;
   m_delay = retval;
+#ifdef PIPELINE
+  if (m_bufferSize > 0)
+    retval += m_bufferSize;
+#endif
   return retval;
 }
 
@@ -1721,6 +2760,7 @@ int RemotePluginClient::getInputCount() {
   waitForServer(m_shmControl3);
   retval = m_shmControl3->retint;
   m_numInputs = retval;
+  lockShm(retval, -1, -1);
   return retval;
 }
 
@@ -1735,6 +2775,7 @@ int RemotePluginClient::getOutputCount() {
   waitForServer(m_shmControl3);
   retval = m_shmControl3->retint;
   m_numOutputs = retval;
+  lockShm(-1, retval, -1);
   return retval;
 }
 
@@ -1793,6 +2834,12 @@ void RemotePluginClient::setCurrentProgram(int n) {
   m_shmControlptr->ropcode = RemotePluginSetCurrentProgram;
   m_shmControlptr->value = n;
   waitForServer(m_shmControlptr);
+#ifdef PARBATCH
+  paramInvalidate(true);
+#endif
+#ifdef CHUNKHASH
+  chunkInvalidate();
+#endif
 }
 
 int RemotePluginClient::getProgram() {
@@ -1804,7 +2851,124 @@ int RemotePluginClient::getProgram() {
   return retval;
 }
 
+#ifdef CHUNKHASH
+// XXH64 of a chunk, the bank/program flag is the seed
+static inline uint64_t xxrotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static const uint64_t xxprime1 = 11400714785074694791ULL;
+static const uint64_t xxprime2 = 14029467366897019727ULL;
+static const uint64_t xxprime3 = 1609587929392839161ULL;
+static const uint64_t xxprime4 = 9650029242287828579ULL;
+static const uint64_t xxprime5 = 2870177450012600261ULL;
+
+static inline uint64_t xxround(uint64_t acc, uint64_t input) {
+  acc += input * xxprime2;
+  return xxrotl(acc, 31) * xxprime1;
+}
+
+static inline uint64_t xxmerge(uint64_t acc, uint64_t val) {
+  acc ^= xxround(0, val);
+  return acc * xxprime1 + xxprime4;
+}
+
+static inline uint64_t xxread64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t xxread32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t chunkHash(const void *data, size_t len, uint64_t seed) {
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + xxprime1 + xxprime2;
+    uint64_t v2 = seed + xxprime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - xxprime1;
+
+    do {
+      v1 = xxround(v1, xxread64(p));
+      v2 = xxround(v2, xxread64(p + 8));
+      v3 = xxround(v3, xxread64(p + 16));
+      v4 = xxround(v4, xxread64(p + 24));
+      p += 32;
+    } while (p <= end - 32);
+
+    h = xxrotl(v1, 1) + xxrotl(v2, 7) + xxrotl(v3, 12) + xxrotl(v4, 18);
+    h = xxmerge(h, v1);
+    h = xxmerge(h, v2);
+    h = xxmerge(h, v3);
+    h = xxmerge(h, v4);
+  } else
+    h = seed + xxprime5;
+
+  h += len;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxround(0, xxread64(p));
+    h = xxrotl(h, 27) * xxprime1 + xxprime4;
+  }
+
+  if (p + 4 <= end) {
+    h ^= (uint64_t)xxread32(p) * xxprime1;
+    h = xxrotl(h, 23) * xxprime2 + xxprime3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    h ^= (*p) * xxprime5;
+    h = xxrotl(h, 11) * xxprime1;
+  }
+
+  h ^= h >> 33;
+  h *= xxprime2;
+  h ^= h >> 29;
+  h *= xxprime3;
+  h ^= h >> 32;
+  return h;
+}
+
+// The state the plugin has now is known while nothing that may change it
+// has happened since gen was read. An open editor can change it without
+// telling the host.
+void RemotePluginClient::chunkConfirm(uint64_t hash, int sz, int gen,
+                                      int ret) {
+  if (m_chunkeditor || m_chunkgen != gen) {
+    m_chunkconfirmed = -1;
+    return;
+  }
+
+  m_chunkhash = hash;
+  m_chunksize = sz;
+  m_chunkret = ret;
+  m_chunkconfirmed = gen;
+}
+#endif
+
 int RemotePluginClient::getChunk(void **ptr, int bank_prg) {
+#ifdef CHUNKHASH
+  int gen = m_chunkgen;
+  int sz = fetchChunk(ptr, bank_prg);
+
+  if (sz > 0)
+    chunkConfirm(chunkHash(*ptr, sz, bank_prg), sz, gen, 0);
+  return sz;
+#else
+  return fetchChunk(ptr, bank_prg);
+#endif
+}
+
+int RemotePluginClient::fetchChunk(void **ptr, int bank_prg) {
 #ifdef CHUNKBUF
   int chunksize;
   int chunks;
@@ -1825,6 +2989,13 @@ int RemotePluginClient::getChunk(void **ptr, int bank_prg) {
   }
 
   if (sz >= CHUNKSIZEMAX) {
+#ifdef CHUNKMAP
+    if (chunkMapRead(m_shmControlptr->retstr, sz)) {
+      *ptr = m_chunkmap;
+      return sz;
+    }
+#endif
+
     if (chunk_ptr)
       free(chunk_ptr);
 
@@ -1886,8 +3057,104 @@ int RemotePluginClient::getChunk(void **ptr, int bank_prg) {
 #endif
 }
 
+#ifdef CHUNKMAP
+// Large chunks are passed in a memfd sized to the chunk instead of 512 KB
+// pieces through the control segment. The one the server wrote for
+// getChunk is handed to the host as it is and kept until the next chunk.
+bool RemotePluginClient::chunkMapRead(const char *path, int sz) {
+  if (m_chunkmap) {
+    munmap(m_chunkmap, m_chunkmapsize);
+    m_chunkmap = 0;
+  }
+
+  if (path[0] != '/')
+    return false;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  char *shm =
+      (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED)
+    return false;
+
+  madvise(shm, sz, MADV_DONTFORK);
+  m_chunkmap = shm;
+  m_chunkmapsize = sz;
+  return true;
+}
+
+bool RemotePluginClient::chunkMapSend(void *ptr, int sz, int bank_prg,
+                                      int *retval) {
+  char tmpFileBase[60];
+  int fd = syscall(SYS_memfd_create, "rplugin_chunk", MFD_CLOEXEC);
+
+  if (fd < 0)
+    return false;
+
+  sprintf(tmpFileBase, "/proc/%d/fd/%d", getpid(), fd);
+
+  char *shm = (char *)MAP_FAILED;
+  if (ftruncate(fd, sz) == 0)
+    shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (shm == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  memcpy(shm, ptr, sz);
+  munmap(shm, sz);
+
+  m_shmControl3->ropcode = RemotePluginSetChunkMap;
+  m_shmControl3->value = sz;
+  m_shmControl3->value2 = bank_prg;
+  strcpy(m_shmControl3->retstr, tmpFileBase);
+  waitForServer(m_shmControl3);
+  close(fd);
+
+  *retval = m_shmControl3->retint;
+  return m_shmControl3->retbool;
+}
+#endif
+
+// Hosts send the same state again on undo, reload or a reverted
+// duplicate. A chunk matching the state the plugin is known to have is
+// not sent at all.
 int RemotePluginClient::setChunk(void *ptr, int sz, int bank_prg) {
+#ifdef CHUNKHASH
+  if (sz > 0 && ptr) {
+    int gen = m_chunkgen;
+    uint64_t hash = chunkHash(ptr, sz, bank_prg);
+
+    if (!m_chunkeditor && m_chunkconfirmed == gen && m_chunksize == sz &&
+        m_chunkhash == hash) {
+#ifdef STATS
+      m_stats.chunkskipped.fetch_add(1, std::memory_order_relaxed);
+#endif
+      return m_chunkret;
+    }
+
+    int retval = sendChunk(ptr, sz, bank_prg);
+    chunkConfirm(hash, sz, gen, retval);
+#ifdef STATS
+    m_stats.chunksent.fetch_add(1, std::memory_order_relaxed);
+#endif
+    return retval;
+  }
+#endif
+  return sendChunk(ptr, sz, bank_prg);
+}
+
+int RemotePluginClient::sendChunk(void *ptr, int sz, int bank_prg) {
   int retval;
+
+#ifdef PARBATCH
+  paramInvalidate(true);
+#endif
 #ifdef CHUNKBUF
   char *ptridx;
   int sz2;
@@ -1901,6 +3168,11 @@ int RemotePluginClient::setChunk(void *ptr, int sz, int bank_prg) {
   ShmControl *m_shmControlptr = m_shmControl3;      
 
   if (sz >= CHUNKSIZEMAX) {
+#ifdef CHUNKMAP
+    if (chunkMapSend(ptr, sz, bank_prg, &retval))
+      return retval;
+#endif
+
     ptridx = (char *)ptr;
     sz2 = sz;
 
@@ -1977,10 +3249,10 @@ int RemotePluginClient::setChunk(void *ptr, int sz, int bank_prg) {
 void RemotePluginClient::RemotePluginClosedException() {
   m_inexcept = 1;
 
-  waitForClientexit();
-
   m_threadbreak = 1;
 
+  waitForClientexit();
+
   /*
   #ifdef EMBED
   m_threadbreakembed = 1;
@@ -2029,10 +3301,16 @@ bool RemotePluginClient::fwait2(ShmControl *m_shmControlptr,
                                 std::atomic_int *futexp, int ms) {
   timespec timeval;
   int retval;
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
 
+  timespec *timeout = NULL;
+
+  // ms > 0 waits that long, 0 only takes a posted count, < 0 waits until
+  // posted
   if (ms > 0) {
     timeval.tv_sec = ms / 1000;
     timeval.tv_nsec = (ms %= 1000) * 1000000;
+    timeout = &timeval;
   }
 
   for (;;) {
@@ -2040,12 +3318,14 @@ bool RemotePluginClient::fwait2(ShmControl *m_shmControlptr,
     if ((*futexp != 0) &&
         (std::atomic_compare_exchange_strong(futexp, &value, value - 1) > 0))
       break;
-    // std::atomic_fetch_add_explicit((std::atomic_int
-    // *)&m_shmControlptr->nwaitersclient, 1, std::memory_order_seq_cst);
-    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, &timeval, NULL, 0);
-    // std::atomic_fetch_sub_explicit((std::atomic_int
-    // *)&m_shmControlptr->nwaitersclient, 1, std::memory_order_seq_cst);
-    if (retval == -1 && errno != EAGAIN)
+    if (ms == 0) {
+      errno = ETIMEDOUT;
+      return true;
+    }
+    std::atomic_fetch_add_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, timeout, NULL, 0);
+    std::atomic_fetch_sub_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
       return true;
   }
   return false;
@@ -2053,15 +3333,23 @@ bool RemotePluginClient::fwait2(ShmControl *m_shmControlptr,
 
 bool RemotePluginClient::fpost2(ShmControl *m_shmControlptr,
                                 std::atomic_int *futexp) {
-  int retval;
-  int nval =
-      std::atomic_fetch_add_explicit(futexp, 1, std::memory_order_seq_cst);
-  // int value = atomic_load_explicit((std::atomic_int
-  // *)&m_shmControlptr->nwaitersserver, std::memory_order_seq_cst); if(value >
-  // 0)
-  //{
-  retval = syscall(SYS_futex, futexp, FUTEX_WAKE, 1, NULL, NULL, 0);
-  //}
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
+
+  std::atomic_fetch_add_explicit(futexp, 1, std::memory_order_seq_cst);
+
+  // a waiter registers before FUTEX_WAIT rechecks the count, so no
+  // registered waiter means nobody can be asleep on the word
+  if (atomic_load_explicit(nwaiters, std::memory_order_seq_cst) == 0) {
+#ifdef STATS
+    m_stats.wakeskipped.fetch_add(1, std::memory_order_relaxed);
+#endif
+    return false;
+  }
+
+  syscall(SYS_futex, futexp, FUTEX_WAKE, 1, NULL, NULL, 0);
+#ifdef STATS
+  m_stats.wakesent.fetch_add(1, std::memory_order_relaxed);
+#endif
   /*
           if (retval  == -1)
           return true;
@@ -2074,9 +3362,12 @@ bool RemotePluginClient::fwait(ShmControl *m_shmControlptr,
   timespec timeval;
   int retval;
 
+  timespec *timeout = NULL;
+
   if (ms > 0) {
     timeval.tv_sec = ms / 1000;
     timeval.tv_nsec = (ms %= 1000) * 1000000;
+    timeout = &timeval;
   }
 
   for (;;) {
@@ -2084,8 +3375,12 @@ bool RemotePluginClient::fwait(ShmControl *m_shmControlptr,
     if ((*futexp != 0) &&
         (std::atomic_compare_exchange_strong(futexp, &value, value - 1) > 0))
       break;
-    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, &timeval, NULL, 0);
-    if (retval == -1 && errno != EAGAIN)
+    if (ms == 0) {
+      errno = ETIMEDOUT;
+      return true;
+    }
+    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, timeout, NULL, 0);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
       return true;
   }
   return false;
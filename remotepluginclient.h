@@ -46,6 +46,9 @@ typedef intptr_t VstIntPtr;
 #endif
 
 #include <atomic>
+#if defined(PIPELINE) || defined(SCANCACHE)
+#include <mutex>
+#endif
 
 // Any of the methods in this file, including constructors, should be
 // considered capable of throwing RemotePluginClosedException.  Do not
@@ -117,6 +120,8 @@ public:
 #endif
   int getChunk(void **ptr, int bank_prog);
   int setChunk(void *ptr, int sz, int bank_prog);
+  int fetchChunk(void **ptr, int bank_prog);
+  int sendChunk(void *ptr, int sz, int bank_prog);
   int canBeAutomated(int param);
   int getProgram();
   int EffectOpen();
@@ -128,6 +133,15 @@ public:
   void process(float **inputs, float **outputs, int sampleFrames);
 
   void waitForServer(ShmControl *m_shmControlptr);
+  void waitForServerProcess(ShmControl *m_shmControlptr);
+#ifdef PIPELINE
+  void pipeWait();
+  void pipePost(void **outputs, int offset, int sampleFrames, int ropcode,
+                size_t elsize);
+  void pipeProcess(void **inputs, void **outputs, int sampleFrames,
+                   int ropcode, size_t elsize);
+  void pipeReset(int channels, size_t elsize);
+#endif
 
   void waitForServer2exit();
   void waitForServer3exit();
@@ -160,6 +174,41 @@ public:
   int m_runok;
   int m_syncok;
   int m_386run;
+
+#ifdef SCANCACHE
+  // what a host scan asks for, kept on disk per plugin by linvst.cpp
+  struct ScanInfo {
+    int numinputs;
+    int numoutputs;
+    int numprograms;
+    int numparams;
+    int flags;
+    int delay;
+    int uid;
+    int category;
+    std::string name;
+    std::string maker;
+    // the values of a freshly loaded plugin
+    std::vector<float> params;
+  };
+
+  // 1 while the server is not started and the host is answered from
+  // m_scaninfo, 2 if starting it later failed. m_lazylock is held while
+  // the server is started and by parameter calls that are answered lazily.
+  std::atomic_int m_lazy;
+  std::mutex m_lazylock;
+  ScanInfo m_scaninfo;
+  std::string m_scanpath;
+  std::string m_scanpart;
+  // calls the host made before the server was started, replayed on start
+  int m_lazyopen;
+  int m_lazysamplerate;
+  int m_lazyblocksize;
+  std::vector<float> m_lazyparams;
+  std::vector<char> m_lazyset;
+#endif
+
+  virtual void startServer() {}
   AEffect *theEffect;
   AEffect theEffect2;
   audioMasterCallback m_audioMaster;
@@ -186,6 +235,24 @@ public:
   int m_delay;
 #ifdef CHUNKBUF
   char *chunk_ptr;
+#ifdef CHUNKMAP
+  char *m_chunkmap;
+  size_t m_chunkmapsize;
+
+  bool chunkMapRead(const char *path, int sz);
+  bool chunkMapSend(void *ptr, int sz, int bank_prg, int *retval);
+#endif
+#endif
+#ifdef CHUNKHASH
+  std::atomic_int m_chunkgen;
+  int m_chunkconfirmed;
+  int m_chunkeditor;
+  int m_chunksize;
+  int m_chunkret;
+  uint64_t m_chunkhash;
+
+  void chunkInvalidate() { m_chunkgen++; }
+  void chunkConfirm(uint64_t hash, int sz, int gen, int ret);
 #endif
 
 #ifdef EMBED
@@ -228,12 +295,65 @@ public:
   char *m_shm5;
 #ifdef PCACHE
   char *m_shm6;
+  size_t m_shm6size;
+  ParamCache m_parcache;
+
+  void parCacheCreate(int count);
+#ifdef PDISPLAY
+  bool displayCached(int p, char *text);
+#endif
+#ifdef PMETA
+  bool metaCached(int p, ParamMeta *meta);
+#endif
+#endif
+#ifdef AMRING
+  AMRing *m_amring;
+  std::atomic_int m_amdrain;
+
+  struct AMEvents {
+    int numEvents;
+    void *reserved;
+    VstEvent *events[AMRINGCOUNT];
+  } m_amevents;
+
+  void amDrain();
+#endif
+#ifdef OUTEVENTS
+  OutEvents *m_outevents;
 
-  struct alignas(64) ParamState {
-  float value;
-  float valueupdate;
-  char changed;
+  struct OutEventList {
+    int numEvents;
+    void *reserved;
+    VstEvent *events[OUTEVENTSCOUNT];
+  } m_outlist;
+
+  void outEventsDeliver();
+#endif
+#ifdef PARBATCH
+  BatchRequest *m_parbatch;
+
+  struct ParamInfo {
+    std::string name;
+    std::string label;
+    std::string display;
+    int automate;
+    int namegen;
+    int displaygen;
   };
+
+  std::vector<ParamInfo> m_parinfo;
+  std::atomic_int m_namegen;
+  std::atomic_int m_displaygen;
+  int m_displaynext;
+  int m_displayseen;
+#ifdef ASYNCLOAD
+  int m_loadseen;
+#endif
+
+  ParamInfo *paramInfo(int p, bool display);
+  void paramFetch(int start, int count, bool names, int namegen,
+                  int displaygen);
+  void paramInvalidate(bool names);
 #endif
 
   int m_inexcept;
@@ -276,9 +396,15 @@ private:
   char *m_shmFileName;
   char *m_shm;
   size_t m_shmSize;
+  size_t m_proclocked;
+  size_t m_parlocked;
+  int m_lockins;
+  int m_lockouts;
+  int m_lockparams;
   char *m_shm2;
 
   int sizeShm();
+  void lockShm(int ins, int outs, int params);
 
   pthread_t m_AMThread;
   static void *callAMThread(void *arg) {
@@ -287,6 +413,54 @@ private:
   void *AMThread();
   int m_threadinit;
 
+#ifdef SPINWAIT
+  long long m_turnaround;
+  long long m_spinbudget;
+#endif
+
+#ifdef PIPELINE
+  // block in flight on the server, the output fifo that delays everything
+  // by one buffer and the two event areas the blocks take turns on.
+  // m_pipelock is held by process() and by the calls of other threads
+  // that need the audio thread of the server to be idle.
+  std::mutex m_pipelock;
+  char *m_pipeevents[2];
+  int m_pipearea;
+  std::atomic_int m_pipeinflight;
+  int m_pipeframes;
+  int m_pipechannels;
+  int m_pipecap;
+  int m_piperead;
+  int m_pipewrite;
+  size_t m_pipeelsize;
+  std::vector<char> m_pipefifo;
+#endif
+
+#ifdef PARAMQUEUE
+  // changes for the next block, filled by setParameter from any thread and
+  // moved to the shared queue when the block is sent. A bounded MPSC ring,
+  // seq is the position a slot is free for and one past it once filled.
+  struct ParamSlot {
+    std::atomic_uint seq;
+    ParamChange change;
+  };
+
+  ParamSlot m_parqueue[PARQUEUECOUNT];
+  std::atomic_uint m_parqueuehead;
+  unsigned int m_parqueuetail;
+  pthread_t m_processthread;
+  std::atomic<long long> m_blockstart;
+  int m_sampleRate;
+
+  bool parQueuePush(int p, float v);
+  void parQueueShip(int sampleFrames);
+#endif
+
+#ifdef STATS
+  RemotePluginStats m_stats;
+  void printStats();
+#endif
+
   void RemotePluginClosedException();
 
   bool fwait(ShmControl *m_shmControlptr, std::atomic_int *fcount, int ms);
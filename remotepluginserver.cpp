@@ -31,7 +31,9 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <iostream>
+#include <sched.h>
 #include <time.h>
 
 RemotePluginServer::RemotePluginServer(std::string fileIdentifiers)
@@ -39,11 +41,15 @@ RemotePluginServer::RemotePluginServer(std::string fileIdentifiers)
       m_updatein(0), m_updateout(0),
 #ifdef CHUNKBUF
       chunkptr(0), chunkptr2(0),
+#ifdef CHUNKMAP
+      chunkmapsize(0), m_chunkfd(-1),
+#endif
 #endif
       m_flags(0), m_delay(0), timeinfo(0), bufferSize(1024), sampleRate(44100),
       m_inexcept(0), m_shmFd(-1), m_shmControl(0), m_shmControl2(0),
       m_shmControl3(0), m_shmControl4(0), m_shmControl5(0), m_shmControl6(0), m_shmFileName(0),
-      m_shm(0), m_shmSize(0), m_shm2(0), m_shm3(0), m_shm4(0), m_shm5(0),
+      m_shm(0), m_shmSize(0), m_proclocked(0), m_parlocked(0), m_lockins(0),
+      m_lockouts(0), m_lockparams(0), m_shm2(0), m_shm3(0), m_shm4(0), m_shm5(0),
 #ifndef INOUTMEM
       m_inputs(0), m_outputs(0),
 #ifdef DOUBLEP
@@ -56,15 +62,31 @@ RemotePluginServer::RemotePluginServer(std::string fileIdentifiers)
 #endif
 #endif
 #ifdef PCACHE
-     m_shm6(0),
+     m_shm6(0), m_shm6size(0), m_parcache(),
 #endif    
+#ifdef SPINWAIT
+      m_turnaround(0), m_spinbudget(0), m_replytime(0),
+#endif
+#ifdef AMRING
+      m_amring(0), m_audiothreadid(0),
+#endif
+#ifdef PARBATCH
+      m_parbatch(0),
+#endif
+#ifdef OUTEVENTS
+      m_outevents(0),
+#endif
       m_threadsfinish(0), m_386run(0), starterror(0) {
   char tmpFileBase[60];
   int startok;
 
-  sprintf(tmpFileBase, "/tmp/rplugin_shm_%s", fileIdentifiers.substr(0, 6).c_str());
-
-  m_shmFileName = strdup(tmpFileBase);
+  // a memfd segment comes as /proc/<pid>/fd/<fd> of the client
+  if (fileIdentifiers[0] == '/')
+    m_shmFileName = strdup(fileIdentifiers.c_str());
+  else {
+    sprintf(tmpFileBase, "/tmp/rplugin_shm_%s", fileIdentifiers.substr(0, 6).c_str());
+    m_shmFileName = strdup(tmpFileBase);
+  }
 
   if ((m_shmFd = open(m_shmFileName, O_RDWR)) < 0) {
     starterror = 1;
@@ -123,6 +145,9 @@ RemotePluginServer::RemotePluginServer(std::string fileIdentifiers)
 }
 
 RemotePluginServer::~RemotePluginServer() {
+#ifdef STATS
+  printStats();
+#endif
   if (starterror == 0) {
 #ifndef INOUTMEM
     if (m_inputs) {
@@ -155,7 +180,29 @@ RemotePluginServer::~RemotePluginServer() {
   }
 }
 
+#ifdef STATS
+void RemotePluginServer::printStats() {
+  std::cerr << "LinVst3 server stats: wakes " << m_stats.wakesent
+            << " wakes skipped " << m_stats.wakeskipped << std::endl;
+#ifdef PCACHE
+  std::cerr << "LinVst3 server stats: parameter flushes " << m_stats.parblocks
+            << " entries visited " << m_stats.parvisited << std::endl;
+#endif
+}
+#endif
+
 void RemotePluginServer::cleanup() {
+#ifdef CHUNKMAP
+  chunkMapRelease();
+#endif
+#ifdef PCACHE
+  if (m_shm6) {
+    munmap(m_shm6, m_shm6size);
+    m_shm6 = 0;
+    m_parcache.count = 0;
+  }
+#endif
+
   if (m_shm) {
     munmap(m_shm, m_shmSize);
     m_shm = 0;
@@ -167,12 +214,188 @@ void RemotePluginServer::cleanup() {
   }
 
   if (m_shmFileName) {
-    unlink(m_shmFileName);
+    if (strncmp(m_shmFileName, "/proc/", 6))
+      unlink(m_shmFileName);
     free(m_shmFileName);
     m_shmFileName = 0;
   }
 }
 
+// Locks the part of the process area the current channel count and block
+// size use, and the parameter cache entries of the plugin. -1 keeps the
+// previous value.
+void RemotePluginServer::lockShm(int ins, int outs, int params) {
+  if (!m_shm)
+    return;
+
+  if (ins >= 0)
+    m_lockins = ins;
+  if (outs >= 0)
+    m_lockouts = outs;
+  if (params >= 0)
+    m_lockparams = params;
+
+#ifdef DOUBLEP
+  size_t elsize = sizeof(double);
+#else
+  size_t elsize = sizeof(float);
+#endif
+
+  size_t procsz = 0;
+
+  if (m_bufferSize > 0)
+    procsz = std::max(m_lockins, m_lockouts) * m_bufferSize * elsize;
+
+  flockrange(m_shm, &m_proclocked, procsz, PROCESSSIZE);
+
+#ifdef PCACHE
+  // the parameter cache is sized for the plugin, all of it is in use
+  if (m_shm6)
+    flockrange(m_shm6, &m_parlocked, m_lockparams > 0 ? m_shm6size : 0,
+               m_shm6size);
+#endif
+}
+
+#ifdef PCACHE
+// maps the parameter cache the client created for count parameters and
+// fills it with the current values, returns 1 on success
+int RemotePluginServer::parCacheMap(const char *name, int count) {
+  if (m_shm6 || count <= 0)
+    return 0;
+
+  int fd = open(name, O_RDWR);
+  if (fd < 0)
+    return 0;
+
+  size_t sz = pcachesize(count);
+  char *shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED)
+    return 0;
+
+  m_shm6 = shm;
+  m_shm6size = sz;
+  pcachelayout(m_shm6, count, &m_parcache);
+
+#ifdef PMETA
+  parMetaBuild(getParameterCount());
+#else
+  getParameterCount();
+#endif
+  lockShm(-1, -1, -1);
+  return 1;
+}
+#endif
+
+#ifdef PMETA
+// Names, labels and properties only change with the parameter titles, the
+// client answers them from this table without a round trip. Built once
+// the cache is mapped and again when the plugin reports new titles.
+void RemotePluginServer::parMetaBuild(int count) {
+  if (!m_shm6)
+    return;
+
+  int seq = m_parcache.metaseq->load(std::memory_order_relaxed);
+
+  m_parcache.metaseq->store(seq | 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (int i = 0; i < m_parcache.count; i++) {
+    ParamMeta *meta = &m_parcache.meta[i];
+
+    memset(meta, 0, sizeof(ParamMeta));
+    if (i >= count)
+      continue;
+
+    strncpy(meta->name, getParameterName(i).c_str(), PMETANAMELEN - 1);
+    strncpy(meta->label, getParameterLabel(i).c_str(), PMETALABELLEN - 1);
+    getParameterMeta(i, meta);
+  }
+
+  m_parcache.metaseq->store((seq | 1) + 1, std::memory_order_release);
+}
+#endif
+
+#ifdef CHUNKMAP
+// Large chunks go through a memfd of their own, sized to the chunk. The
+// client maps the one written here through /proc, it stays open until the
+// next chunk so the client can map it after the reply.
+bool RemotePluginServer::chunkMapWrite(const void *data, int sz, char *path) {
+  chunkMapRelease();
+  path[0] = '\0';
+
+  int fd = syscall(SYS_memfd_create, "rplugin_chunk", MFD_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  char *shm = (char *)MAP_FAILED;
+  if (ftruncate(fd, sz) == 0)
+    shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (shm == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  memcpy(shm, data, sz);
+  munmap(shm, sz);
+
+  m_chunkfd = fd;
+  sprintf(path, "/proc/%d/fd/%d", getpid(), fd);
+  return true;
+}
+
+// maps a chunk the client has written, setChunk unmaps it again
+char *RemotePluginServer::chunkMapOpen(const char *path, int sz) {
+  chunkMapRelease();
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0)
+    return 0;
+
+  char *shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED)
+    return 0;
+
+  return shm;
+}
+
+void RemotePluginServer::chunkMapRelease() {
+  if (m_chunkfd >= 0) {
+    close(m_chunkfd);
+    m_chunkfd = -1;
+  }
+}
+#endif
+
+#ifdef PDISPLAY
+// Display strings are kept in the parameter cache until the value changes.
+// inval is read before the string is made, so a change meanwhile leaves the
+// slot stale. A slot another thread is writing is left alone.
+std::string RemotePluginServer::parameterDisplay(int p) {
+  if (p < 0 || p >= m_parcache.count)
+    return getParameterDisplay(p);
+
+  ParamDisplay *slot = &m_parcache.display[p];
+  int inval = slot->inval.load(std::memory_order_acquire);
+  std::string display = getParameterDisplay(p);
+  int seq = slot->seq.load(std::memory_order_relaxed);
+
+  if ((display.size() < PDISPLAYLEN) && !(seq & 1) &&
+      slot->seq.compare_exchange_strong(seq, seq + 1,
+                                        std::memory_order_acquire)) {
+    memcpy(slot->text, display.c_str(), display.size() + 1);
+    slot->filled.store(inval + 1, std::memory_order_relaxed);
+    slot->seq.store(seq + 2, std::memory_order_release);
+  }
+
+  return display;
+}
+#endif
+
 int RemotePluginServer::sizeShm() {
   if (m_shm)
     return 0;
@@ -229,36 +452,83 @@ int chunkrem;
 
     int chunksizecontrol = chunks * pagesize;
 
-#ifdef PCACHE
-    chunksize = PARCACHE;
+#ifdef AMRING
+    chunksize = sizeof(AMRing);
     chunks = chunksize / pagesize;
     chunkrem = chunksize % pagesize;
 
     if(chunkrem > 0)
     chunks += 1;
 
-    int parcachesize = chunks * pagesize;
-  size_t sz = processsize + vsteventsprocess + chunksizemax + vsteventssend + (chunksizecontrol * 6) + parcachesize;
-#else
+    int amringsize = chunks * pagesize;
+#endif
+
+#ifdef PARBATCH
+    chunksize = sizeof(BatchRequest);
+    chunks = chunksize / pagesize;
+    chunkrem = chunksize % pagesize;
+
+    if(chunkrem > 0)
+    chunks += 1;
+
+    int parbatchsize = chunks * pagesize;
+#endif
+
+#ifdef OUTEVENTS
+    chunksize = sizeof(OutEvents);
+    chunks = chunksize / pagesize;
+    chunkrem = chunksize % pagesize;
+
+    if(chunkrem > 0)
+    chunks += 1;
+
+    int outeventssize = chunks * pagesize;
+#endif
+
   size_t sz = processsize + vsteventsprocess + chunksizemax + vsteventssend + (chunksizecontrol * 6);
-#endif  
+
+#ifdef AMRING
+  size_t amringoffset = sz;
+  sz += amringsize;
+#endif
+#ifdef PARBATCH
+  size_t parbatchoffset = sz;
+  sz += parbatchsize;
+#endif
+#ifdef OUTEVENTS
+  size_t outeventsoffset = sz;
+  sz += outeventssize;
+#endif
+#ifdef PIPELINE
+  // a second event area, one is filled while the server reads the other
+  size_t pipeeventsoffset = sz;
+  sz += vsteventsprocess;
+#endif
+
+  // the client may have rounded a hugetlb segment up to the huge page size
+  struct stat shmstat;
+
+  if ((fstat(m_shmFd, &shmstat) == 0) && ((size_t)shmstat.st_size > sz))
+    sz = shmstat.st_size;
   
-  m_shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
-                       m_shmFd, 0);
-  if (!m_shm) {
+  m_shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, m_shmFd, 0);
+  if (m_shm == MAP_FAILED) {
     std::cerr
         << "RemotePluginServer::sizeShm: ERROR: mmap or mremap for failed for "
         << sz << " bytes from fd " << m_shmFd << "!" << std::endl;
+    m_shm = 0;
     m_shmSize = 0;
     return 1;
   } else {
 
-    madvise(m_shm, sz, MADV_SEQUENTIAL | MADV_WILLNEED | MADV_DONTFORK);
-    memset(m_shm, 0, sz);
+    // madvise advice values are not flags, they can not be or'ed together
+    madvise(m_shm, sz, MADV_DONTFORK);
+#ifdef HUGEPAGES
+    madvise(m_shm, processsize + vsteventsprocess, MADV_HUGEPAGE);
+#endif
+    // a new memfd or tmp file reads as zeros, touching all of it would
+    // allocate the whole segment
     m_shmSize = sz;
-
-    if (mlock(m_shm, sz) != 0)
-      perror("mlock fail1");
   }
 
   m_shm2 = &m_shm[processsize];
@@ -267,9 +537,34 @@ int chunkrem;
 
   m_shm5 = &m_shm[processsize + vsteventsprocess + chunksizemax + vsteventssend];
 
-#ifdef PCACHE
-  m_shm6 = &m_shm[processsize + vsteventsprocess + chunksizemax + vsteventssend + (chunksizecontrol * 6)];
-#endif  
+#ifdef AMRING
+  m_amring = (AMRing *)&m_shm[amringoffset];
+#endif
+#ifdef PARBATCH
+  m_parbatch = (BatchRequest *)&m_shm[parbatchoffset];
+#endif
+#ifdef OUTEVENTS
+  m_outevents = (OutEvents *)&m_shm[outeventsoffset];
+#endif
+#ifdef PIPELINE
+  m_pipeevents[0] = m_shm2;
+  m_pipeevents[1] = &m_shm[pipeeventsoffset];
+#endif
+
+  // the process area and parameter cache are locked by lockShm() as the
+  // configuration becomes known, these are always used
+  if (mlock(m_shm2, vsteventsprocess) != 0)
+    perror("mlock fail1");
+#ifdef PIPELINE
+  if (mlock(m_pipeevents[1], vsteventsprocess) != 0)
+    perror("mlock fail1");
+#endif
+  if (mlock(m_shm5, chunksizecontrol * 6) != 0)
+    perror("mlock fail1");
+#ifdef AMRING
+  if (mlock(m_amring, amringsize) != 0)
+    perror("mlock fail1");
+#endif
 
   m_shmControl = (ShmControl *)m_shm5;
 //  memset(m_shmControl, 0, sizeof(ShmControl));
@@ -284,31 +579,19 @@ int chunkrem;
   m_shmControl6 = (ShmControl *)&m_shm5[chunksizecontrol * 5];
 //  memset(m_shmControl6, 0, sizeof(ShmControl));  
 
-  int startok;
-
-  startok = 0;
-
   ptr = (int *)m_shm;
 
-  *ptr = 490;
-
-  for (int i = 0; i < 400000; i++) {
-    if ((*ptr == 2) || (*ptr == 3)) {
-      startok = 1;
-      break;
-    }
+  fstartset(ptr, StartupMapped);
 
-    if (*ptr == 4) {
-      startok = 0;
-      break;
-    }
-    usleep(100);
-  }
+  int state = fstartwait(ptr, StartupMapped, STARTUPTIMEOUT);
 
-  if (startok == 0)
+  if ((state != StartupClientOk) && (state != StartupClientOk386)) {
+    std::cerr << "dssi-vst-server: client did not answer (state " << state
+              << ")" << std::endl;
     return 1;
+  }
 
-  if (*ptr == 3)
+  if (state == StartupClientOk386)
     m_386run = 1;
 
   return 0;
@@ -339,6 +622,155 @@ void RemotePluginServer::waitForClient6exit() {
   fpost(m_shmControl6, &m_shmControl6->runServer);
 }
 
+#ifdef AMRING
+// claims count entries in a row, or none if the ring has no room. Only
+// the CAS on head is contended, a failed one means another thread got in.
+bool RemotePluginServer::amClaim(int count, unsigned int *pos) {
+  unsigned int head =
+      atomic_load_explicit(&m_amring->head, std::memory_order_relaxed);
+
+  for (;;) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+      unsigned int p = head + i;
+      if (m_amring->entry[p & (AMRINGCOUNT - 1)].seq.load(
+              std::memory_order_acquire) != p)
+        break;
+    }
+
+    if (i < count) {
+      // full, unless head moved on while the entries were looked at
+      unsigned int now =
+          atomic_load_explicit(&m_amring->head, std::memory_order_relaxed);
+      if (now == head)
+        return false;
+      head = now;
+      continue;
+    }
+
+    if (m_amring->head.compare_exchange_weak(head, head + count,
+                                             std::memory_order_relaxed)) {
+      *pos = head;
+      return true;
+    }
+  }
+}
+
+bool RemotePluginServer::amPush(int opcode, int index, float value) {
+  unsigned int pos;
+
+  if (!amClaim(1, &pos))
+    return false;
+
+  AMEntry *entry = &m_amring->entry[pos & (AMRINGCOUNT - 1)];
+  entry->opcode = opcode;
+  entry->index = index;
+  entry->value = value;
+  entry->size = 0;
+
+  entry->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+#ifdef OUTEVENTS
+// events sent from inside process() go back with the process reply, all
+// of them or none
+bool RemotePluginServer::outEventsPush(VstEvents *evnts) {
+  int count = m_outevents->count;
+  int size = m_outevents->size;
+  int eventnum;
+  int eventsize = 0;
+
+  for (int i = 0; i < evnts->numEvents; i++) {
+#ifdef SYSEX
+    eventsize += evpackedsize(evnts->events[i]);
+#else
+    if (evnts->events[i]->type == kVstSysExType)
+      return false;
+    eventsize += evnts->events[i]->byteSize + (2 * sizeof(VstInt32));
+#endif
+  }
+
+  eventnum = evnts->numEvents;
+
+  if ((count + eventnum > OUTEVENTSCOUNT) ||
+      (size + eventsize > OUTEVENTSSIZE))
+    return false;
+
+  for (int i = 0; i < evnts->numEvents; i++) {
+    VstEvent *pEvent = evnts->events[i];
+#ifdef SYSEX
+    size += evpack(&m_outevents->data[size], pEvent);
+#else
+    memcpy(&m_outevents->data[size], pEvent,
+           pEvent->byteSize + (2 * sizeof(VstInt32)));
+    size += pEvent->byteSize + (2 * sizeof(VstInt32));
+#endif
+  }
+
+  m_outevents->size = size;
+  m_outevents->count = count + eventnum;
+  return true;
+}
+#endif
+
+// all of the events go in or none do, so they never overtake each other
+bool RemotePluginServer::amPushEvents(VstEvents *evnts) {
+  int eventnum = 0;
+
+  for (int i = 0; i < evnts->numEvents; i++) {
+    VstEvent *pEvent = evnts->events[i];
+#ifdef SYSEX
+    // a dump does not fit an entry, it goes through the event area
+    if (pEvent->type == kVstSysExType)
+      return false;
+#endif
+    if (pEvent->type == kVstSysExType)
+      continue;
+    if ((pEvent->byteSize + (2 * sizeof(VstInt32))) > sizeof(AMEntry::data))
+      return false;
+    eventnum++;
+  }
+
+  unsigned int pos;
+
+  if (eventnum == 0)
+    return true;
+  if (!amClaim(eventnum, &pos))
+    return false;
+
+  for (int i = 0; i < evnts->numEvents; i++) {
+    VstEvent *pEvent = evnts->events[i];
+    if (pEvent->type == kVstSysExType)
+      continue;
+    AMEntry *entry = &m_amring->entry[pos & (AMRINGCOUNT - 1)];
+    entry->opcode = audioMasterProcessEvents;
+    entry->index = 0;
+    entry->value = 0;
+    entry->size = pEvent->byteSize + (2 * sizeof(VstInt32));
+    memcpy(entry->data, pEvent, entry->size);
+    entry->seq.store(pos + 1, std::memory_order_release);
+    pos++;
+  }
+
+  return true;
+}
+
+// the client drains after every process block, callbacks from any other
+// thread kick the AMThread unless a kick is already pending
+void RemotePluginServer::amNotify() {
+  if (GetCurrentThreadId() == m_audiothreadid)
+    return;
+
+  if (atomic_load_explicit(&m_amring->kick, std::memory_order_seq_cst) > 0)
+    return;
+
+  std::atomic_fetch_add_explicit(&m_amring->kick, 1, std::memory_order_seq_cst);
+  fpost2(m_shmControl, &m_shmControl->runServer);
+}
+#endif
+
 void RemotePluginServer::dispatch(int timeout) {}
 
 void RemotePluginServer::dispatchProcess(int timeout) {
@@ -346,8 +778,20 @@ void RemotePluginServer::dispatchProcess(int timeout) {
 
   m_shmControlptr2 = m_shmControl2;
 
-  if (fwait2(m_shmControlptr2, &m_shmControlptr2->runServer, timeout)) {
+  bool waitfail;
+
+#ifdef SPINWAIT
+  waitfail = !fspin(&m_shmControlptr2->runServer, m_spinbudget) &&
+             fwait2(m_shmControlptr2, &m_shmControlptr2->runServer, timeout);
+#else
+  waitfail = fwait2(m_shmControlptr2, &m_shmControlptr2->runServer, timeout);
+#endif
+
+  if (waitfail) {
     if (errno == ETIMEDOUT) {
+#ifdef SPINWAIT
+      m_spinbudget = 0;
+#endif
       return;
     } else {
       if (m_inexcept == 0)
@@ -355,9 +799,26 @@ void RemotePluginServer::dispatchProcess(int timeout) {
     }
   }
 
+#ifdef SPINWAIT
+  // the gap between the reply and the client's next post, in playback that
+  // is about a buffer and the server sleeps, back to back blocks (renders,
+  // split blocks) are caught by spinning
+  long long starttime = fnanotime();
+
+  if (m_replytime)
+    m_spinbudget = fspinbudget(&m_turnaround,
+                               m_shmControlptr2->posttime - m_replytime);
+#endif
+
   if (m_shmControlptr2->ropcode != RemotePluginNoOpcode)
     dispatchProcessEvents();
 
+#ifdef SPINWAIT
+  m_replytime = fnanotime();
+  m_shmControlptr2->proctime = (int)std::min(m_replytime - starttime,
+                                             (long long)INT_MAX);
+#endif
+
   if (fpost2(m_shmControlptr2, &m_shmControlptr2->runClient)) {
     std::cerr << "Could not post to semaphore\n";
   }
@@ -375,6 +836,10 @@ void RemotePluginServer::dispatchProcessEvents() {
   if (opcode == RemotePluginNoOpcode)
     return;
 
+#ifdef PIPELINE
+  m_shm2 = m_pipeevents[m_shmControlptr2->value3 & 1];
+#endif
+
   switch (opcode) {
   case RemotePluginProcess: {
 #ifndef OLDMIDI
@@ -390,6 +855,13 @@ void RemotePluginServer::dispatchProcessEvents() {
     }
 #endif
 
+#ifdef PARAMQUEUE
+    if (pqueue(m_shm2)->count > 0) {
+      processParamQueue();
+      pqueue(m_shm2)->count = 0;
+    }
+#endif
+
     int sampleFrames = m_shmControlptr2->value2;
     //	if(m_updateio == 1)
 
@@ -485,6 +957,13 @@ void RemotePluginServer::dispatchProcessEvents() {
     }
 #endif
 
+#ifdef PARAMQUEUE
+    if (pqueue(m_shm2)->count > 0) {
+      processParamQueue();
+      pqueue(m_shm2)->count = 0;
+    }
+#endif
+
     int sampleFrames = m_shmControlptr2->value2;
     //	if(m_updateio == 1)
 
@@ -827,6 +1306,7 @@ void RemotePluginServer::dispatchControlEvents(ShmControl *m_shmControlptr) {
 #endif
     m_numInputs = numin;
     m_shmControlptr->retint = numin;
+    lockShm(numin, -1, -1);
     break;
   }
 
@@ -856,6 +1336,7 @@ void RemotePluginServer::dispatchControlEvents(ShmControl *m_shmControlptr) {
 #endif
     m_numOutputs = numout;
     m_shmControlptr->retint = numout;
+    lockShm(-1, numout, -1);
     break;
   }
 
@@ -870,12 +1351,18 @@ void RemotePluginServer::dispatchControlEvents(ShmControl *m_shmControlptr) {
     break;
 
   case RemotePluginGetParameterDisplay:
+#ifdef PDISPLAY
+    strcpy(m_shmControlptr->retstr,
+           parameterDisplay(m_shmControlptr->value).c_str());
+#else
     strcpy(m_shmControlptr->retstr,
            getParameterDisplay(m_shmControlptr->value).c_str());
+#endif
     break;
 
   case RemotePluginGetParameterCount:
     m_shmControlptr->retint = getParameterCount();
+    lockShm(-1, -1, m_shmControlptr->retint);
     break;
 
   case RemotePluginDoVoid: {
@@ -924,6 +1411,7 @@ void RemotePluginServer::dispatchControlEvents(ShmControl *m_shmControlptr) {
     int newSize = m_shmControlptr->value;
     setBufferSize(newSize);
     m_bufferSize = newSize;
+    lockShm(-1, -1, -1);
     break;
   }
 
@@ -974,6 +1462,60 @@ void RemotePluginServer::dispatchControlEvents(ShmControl *m_shmControlptr) {
     canBeAutomated(m_shmControlptr);
     break;
 
+#ifdef PCACHE
+  case RemotePluginParCache:
+    m_shmControlptr->retint =
+        parCacheMap(m_shmControlptr->retstr, m_shmControlptr->value);
+    break;
+#endif
+
+#ifdef PARBATCH
+  case RemotePluginBatch: {
+    int count = m_parbatch->count;
+
+    if (count > PARBATCHCOUNT)
+      count = PARBATCHCOUNT;
+
+    for (int i = 0; i < count; i++) {
+      BatchEntry *entry = &m_parbatch->entry[i];
+      std::string str;
+
+      entry->retint = 0;
+
+      switch (entry->ropcode) {
+      case RemotePluginGetParameterName:
+        str = getParameterName(entry->value);
+        break;
+
+      case RemotePluginGetParameterLabel:
+        str = getParameterLabel(entry->value);
+        break;
+
+      case RemotePluginGetParameterDisplay:
+#ifdef PDISPLAY
+        str = parameterDisplay(entry->value);
+#else
+        str = getParameterDisplay(entry->value);
+#endif
+        break;
+
+      case RemotePluginCanBeAutomated:
+        m_shmControlptr->value = entry->value;
+        canBeAutomated(m_shmControlptr);
+        entry->retint = m_shmControlptr->retint;
+        break;
+
+      default:
+        break;
+      }
+      strncpy(entry->retstr, str.c_str(), PARBATCHSTR - 1);
+      entry->retstr[PARBATCHSTR - 1] = '\0';
+    }
+    m_shmControlptr->retint = count;
+    break;
+  }
+#endif
+
 #ifdef DOUBLEP
   case RemoteSetPrecision: {
     int value = m_shmControlptr->value;
@@ -1074,6 +1616,26 @@ void RemotePluginServer::dispatchControlEvents(ShmControl *m_shmControlptr) {
   }
 #endif
 
+#ifdef CHUNKMAP
+  case RemotePluginSetChunkMap: {
+    int sz = m_shmControlptr->value;
+    char *shm = 0;
+
+    if (sz >= CHUNKSIZEMAX)
+      shm = chunkMapOpen(m_shmControlptr->retstr, sz);
+
+    m_shmControlptr->retbool = shm ? true : false;
+    m_shmControlptr->retint = 0;
+    if (!shm)
+      break;
+
+    chunkptr2 = shm;
+    chunkmapsize = sz;
+    setChunk(m_shmControlptr);
+    break;
+  }
+#endif
+
   default:
     std::cerr << "WARNING: RemotePluginServer::dispatchControlEvents: "
                  "unexpected opcode "
@@ -1115,10 +1677,16 @@ bool RemotePluginServer::fwait2(ShmControl *m_shmControlptr,
                                 std::atomic_int *futexp, int ms) {
   timespec timeval;
   int retval;
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
 
+  timespec *timeout = NULL;
+
+  // ms > 0 waits that long, 0 only takes a posted count, < 0 waits until
+  // posted
   if (ms > 0) {
     timeval.tv_sec = ms / 1000;
     timeval.tv_nsec = (ms %= 1000) * 1000000;
+    timeout = &timeval;
   }
 
   for (;;) {
@@ -1126,28 +1694,104 @@ bool RemotePluginServer::fwait2(ShmControl *m_shmControlptr,
     if ((*futexp != 0) &&
         (std::atomic_compare_exchange_strong(futexp, &value, value - 1) > 0))
       break;
-    // std::atomic_fetch_add_explicit((std::atomic_int
-    // *)&m_shmControlptr->nwaitersserver, 1, std::memory_order_seq_cst);
-    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, &timeval, NULL, 0);
-    // std::atomic_fetch_sub_explicit((std::atomic_int
-    // *)&m_shmControlptr->nwaitersserver, 1, std::memory_order_seq_cst);
-    if (retval == -1 && errno != EAGAIN)
+    if (ms == 0) {
+      errno = ETIMEDOUT;
+      return true;
+    }
+    std::atomic_fetch_add_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, timeout, NULL, 0);
+    std::atomic_fetch_sub_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
+      return true;
+  }
+  return false;
+}
+
+// sleeps until something is posted on futexp but leaves the count for
+// whoever serves the channel
+bool RemotePluginServer::fpeek(ShmControl *m_shmControlptr,
+                               std::atomic_int *futexp) {
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
+  int retval;
+
+  while (atomic_load_explicit(futexp, std::memory_order_seq_cst) == 0) {
+    std::atomic_fetch_add_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, NULL, NULL, 0);
+    std::atomic_fetch_sub_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
       return true;
   }
   return false;
 }
 
+#ifdef FUTEXWAITV
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+// struct futex_waitv from linux/futex.h, which older headers do not have
+struct fwaitvent {
+  uint64_t val;
+  uint64_t uaddr;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+// true if the kernel has futex_waitv (5.16 and later), an empty wait fails
+// with EINVAL there and ENOSYS on older kernels
+bool fwaitvcheck() {
+  return syscall(SYS_futex_waitv, NULL, 0, 0, NULL, 0) == -1 &&
+         errno != ENOSYS;
+}
+
+// sleeps until any of the words is non-zero without consuming anything,
+// controls[i] is 0 for a word that is not part of a channel
+bool RemotePluginServer::fwaitv(ShmControl **controls,
+                                std::atomic_int **futexps, int count) {
+  fwaitvent waiters[4];
+  int retval;
+
+  for (int i = 0; i < count; i++) {
+    waiters[i].val = 0;
+    waiters[i].uaddr = (uintptr_t)futexps[i];
+    waiters[i].flags = 2; // FUTEX2_SIZE_U32, shared
+    waiters[i].reserved = 0;
+    if (controls[i])
+      std::atomic_fetch_add_explicit(fwaiters(controls[i], futexps[i]), 1,
+                                     std::memory_order_seq_cst);
+  }
+
+  retval = syscall(SYS_futex_waitv, waiters, count, 0, NULL, CLOCK_MONOTONIC);
+
+  for (int i = 0; i < count; i++) {
+    if (controls[i])
+      std::atomic_fetch_sub_explicit(fwaiters(controls[i], futexps[i]), 1,
+                                     std::memory_order_seq_cst);
+  }
+
+  return retval == -1 && errno != EAGAIN && errno != EINTR;
+}
+#endif
+
 bool RemotePluginServer::fpost2(ShmControl *m_shmControlptr,
                                 std::atomic_int *futexp) {
-  int retval;
-  int nval =
-      std::atomic_fetch_add_explicit(futexp, 1, std::memory_order_seq_cst);
-  // int value = atomic_load_explicit((std::atomic_int
-  // *)&m_shmControlptr->nwaitersclient, std::memory_order_seq_cst); if(value >
-  // 0)
-  //{
-  retval = syscall(SYS_futex, futexp, FUTEX_WAKE, 1, NULL, NULL, 0);
-  //}
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
+
+  std::atomic_fetch_add_explicit(futexp, 1, std::memory_order_seq_cst);
+
+  // a waiter registers before FUTEX_WAIT rechecks the count, so no
+  // registered waiter means nobody can be asleep on the word
+  if (atomic_load_explicit(nwaiters, std::memory_order_seq_cst) == 0) {
+#ifdef STATS
+    m_stats.wakeskipped.fetch_add(1, std::memory_order_relaxed);
+#endif
+    return false;
+  }
+
+  syscall(SYS_futex, futexp, FUTEX_WAKE, 1, NULL, NULL, 0);
+#ifdef STATS
+  m_stats.wakesent.fetch_add(1, std::memory_order_relaxed);
+#endif
   /*
           if (retval  == -1)
           return true;
@@ -1160,9 +1804,12 @@ bool RemotePluginServer::fwait(ShmControl *m_shmControlptr,
   timespec timeval;
   int retval;
 
+  timespec *timeout = NULL;
+
   if (ms > 0) {
     timeval.tv_sec = ms / 1000;
     timeval.tv_nsec = (ms %= 1000) * 1000000;
+    timeout = &timeval;
   }
 
   for (;;) {
@@ -1170,8 +1817,12 @@ bool RemotePluginServer::fwait(ShmControl *m_shmControlptr,
     if ((*futexp != 0) &&
         (std::atomic_compare_exchange_strong(futexp, &value, value - 1) > 0))
       break;
-    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, &timeval, NULL, 0);
-    if (retval == -1 && errno != EAGAIN)
+    if (ms == 0) {
+      errno = ETIMEDOUT;
+      return true;
+    }
+    retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, timeout, NULL, 0);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
       return true;
   }
   return false;
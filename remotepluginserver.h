@@ -39,6 +39,10 @@ typedef intptr_t VstIntPtr;
 
 #include <atomic>
 
+#ifdef FUTEXWAITV
+bool fwaitvcheck();
+#endif
+
 class RemotePluginServer {
 public:
   virtual ~RemotePluginServer();
@@ -59,6 +63,9 @@ public:
   virtual int getinitialDelay() = 0;
 
   virtual int processVstEvents() = 0;
+#ifdef PARAMQUEUE
+  virtual void processParamQueue() {}
+#endif
 
   virtual void getChunk(ShmControl *m_shmControlptr) = 0;
   virtual void setChunk(ShmControl *m_shmControlptr) = 0;
@@ -78,6 +85,9 @@ public:
   virtual void setParameter(int, float) { return; }
   virtual float getParameter(int) { return 0.0f; }
   virtual float getParameterDefault(int) { return 0.0f; }
+#ifdef PMETA
+  virtual void getParameterMeta(int, ParamMeta *) { return; }
+#endif
   virtual void getParameters(int p0, int pn, float *v) {
     for (int i = p0; i <= pn; ++i)
       v[i - p0] = 0.0f;
@@ -156,6 +166,7 @@ public:
   void dispatchControl2(int timeout = -1); // may throw RemotePluginClosedException
 
   int sizeShm();
+  void lockShm(int ins, int outs, int params);
   char *m_shm;
   char *m_shm2;
   char *m_shm3;
@@ -163,12 +174,37 @@ public:
   char *m_shm5;
 #ifdef PCACHE
   char *m_shm6;
+  size_t m_shm6size;
+  ParamCache m_parcache;
 
-  struct alignas(64) ParamState {
-  float value;
-  float valueupdate;
-  char changed;
-  };
+  int parCacheMap(const char *name, int count);
+#ifdef PDISPLAY
+  std::string parameterDisplay(int p);
+#endif
+#ifdef PMETA
+  void parMetaBuild(int count);
+#endif
+#endif
+#ifdef AMRING
+  AMRing *m_amring;
+  DWORD m_audiothreadid;
+
+  bool amClaim(int count, unsigned int *pos);
+  bool amPush(int opcode, int index, float value);
+  bool amPushEvents(VstEvents *evnts);
+  void amNotify();
+#endif
+#ifdef PARBATCH
+  BatchRequest *m_parbatch;
+#endif
+#ifdef PIPELINE
+  // the client fills one event area while a block reads the other
+  char *m_pipeevents[2];
+#endif
+#ifdef OUTEVENTS
+  OutEvents *m_outevents;
+
+  bool outEventsPush(VstEvents *evnts);
 #endif
 
   int m_shmControlFd;
@@ -194,6 +230,11 @@ private:
   int m_flags;
   int m_shmFd;
   size_t m_shmSize;
+  size_t m_proclocked;
+  size_t m_parlocked;
+  int m_lockins;
+  int m_lockouts;
+  int m_lockparams;
   char *m_shmFileName;
 
 #ifndef INOUTMEM
@@ -210,6 +251,14 @@ public:
 #ifdef CHUNKBUF
   void *chunkptr;
   char *chunkptr2;
+#ifdef CHUNKMAP
+  size_t chunkmapsize;
+  int m_chunkfd;
+
+  bool chunkMapWrite(const void *data, int sz, char *path);
+  char *chunkMapOpen(const char *path, int sz);
+  void chunkMapRelease();
+#endif
 #endif
   int m_bufferSize;
   int m_numInputs;
@@ -247,6 +296,10 @@ public:
 
   bool fwait2(ShmControl *m_shmControlptr, std::atomic_int *fcount, int ms);
   bool fpost2(ShmControl *m_shmControlptr, std::atomic_int *fcount);
+  bool fpeek(ShmControl *m_shmControlptr, std::atomic_int *fcount);
+#ifdef FUTEXWAITV
+  bool fwaitv(ShmControl **controls, std::atomic_int **fcounts, int count);
+#endif
 
   VstTimeInfo *timeinfo;
   VstTimeInfo timeinfo2;
@@ -269,6 +322,17 @@ public:
 
   HANDLE ThreadHandle[4];
 
+#ifdef SPINWAIT
+  long long m_turnaround;
+  long long m_spinbudget;
+  long long m_replytime;
+#endif
+
+#ifdef STATS
+  RemotePluginStats m_stats;
+  void printStats();
+#endif
+
   ShmControl *m_shmControlptr;
 
   int m_updateio;
@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sys/file.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -46,6 +47,187 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
+#if defined(MULTISERVER) || defined(SERVERPOOL)
+// servers are shared per user and wine prefix
+std::string serverSocketName() {
+  std::string prefix;
+  const char *wineprefix = getenv("WINEPREFIX");
+
+  if (wineprefix && wineprefix[0])
+    prefix = wineprefix;
+  else {
+    const char *home = getenv("HOME");
+    prefix = std::string(home ? home : "") + "/.wine";
+  }
+
+  unsigned int hash = 2166136261u;
+  for (unsigned char c : prefix) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "LinVst3-%u-%08x", (unsigned int)getuid(), hash);
+  return name;
+}
+
+// the socket names are abstract and predictable, another user could have
+// taken one to get the plugin path and shared memory names
+bool peerIsUser(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  return (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) &&
+         (cred.uid == getuid());
+}
+
+// hands the server arguments to a running server of this user, false if
+// there is none or it has no free slot
+bool attachServer(std::string sockname, std::string arg) {
+  struct sockaddr_un addr;
+  bool attached = false;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(&addr.sun_path[1], sockname.c_str(), sockname.size());
+  socklen_t addrlen =
+      offsetof(struct sockaddr_un, sun_path) + 1 + sockname.size();
+
+  if ((connect(fd, (struct sockaddr *)&addr, addrlen) == 0) &&
+      peerIsUser(fd)) {
+    std::string line = arg + "\n";
+    struct pollfd pfd = {fd, POLLIN, 0};
+    char reply = 0;
+
+    if ((send(fd, line.c_str(), line.size(), MSG_NOSIGNAL) ==
+         (ssize_t)line.size()) &&
+        (poll(&pfd, 1, 5000) > 0) && (read(fd, &reply, 1) == 1) &&
+        (reply == '1'))
+      attached = (send(fd, &reply, 1, MSG_NOSIGNAL) == 1);
+  }
+
+  close(fd);
+  return attached;
+}
+#endif
+
+#ifdef SERVERPOOL
+// LINVST3_POOL warm servers are kept per wine prefix (default 2, 0 turns the
+// pool off), an unused one exits after LINVST3_POOL_IDLE seconds (default 300)
+int poolSize() {
+  const char *env = getenv("LINVST3_POOL");
+  int size = env ? atoi(env) : 2;
+
+  if (size < 0)
+    size = 0;
+  if (size > 16)
+    size = 16;
+  return size;
+}
+
+std::string poolSocketName(int n) {
+  return serverSocketName() + "-pool" + std::to_string(n);
+}
+
+bool attachPool(std::string arg) {
+  for (int n = 0; n < poolSize(); n++) {
+    if (attachServer(poolSocketName(n), arg))
+      return true;
+  }
+  return false;
+}
+
+// the pool lock files live in a directory only this user can write to
+std::string poolLockDir() {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+  if (runtime && runtime[0])
+    return runtime;
+
+  const char *home = getenv("HOME");
+  if (!home)
+    return "";
+
+  std::string dir = std::string(home) + "/.cache";
+  mkdir(dir.c_str(), 0700);
+  return dir;
+}
+
+// Starts a pooled server for every pool slot that is free. A slot is
+// claimed with a flock on its lock file. The server inherits the lock and
+// drops it once it listens on the slot name, so instances that open at the
+// same time do not start servers for the same slot.
+void fillPool() {
+  const char *env = getenv("LINVST3_POOL_IDLE");
+  int idle = env ? atoi(env) : 300;
+
+  if (idle <= 0)
+    idle = 300;
+
+  std::string lockdir = poolLockDir();
+  if (lockdir.empty())
+    return;
+
+  for (int n = 0; n < poolSize(); n++) {
+    std::string sockname = poolSocketName(n);
+    std::string lockname = lockdir + "/" + sockname + ".lock";
+    struct sockaddr_un addr;
+
+    int lockfd = open(lockname.c_str(),
+                      O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (lockfd < 0)
+      return;
+
+    if (flock(lockfd, LOCK_EX | LOCK_NB) != 0) {
+      close(lockfd);
+      continue;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      close(lockfd);
+      return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(&addr.sun_path[1], sockname.c_str(), sockname.size());
+    socklen_t addrlen =
+        offsetof(struct sockaddr_un, sun_path) + 1 + sockname.size();
+
+    int listening = (connect(fd, (struct sockaddr *)&addr, addrlen) == 0);
+    close(fd);
+
+    if (listening) {
+      close(lockfd);
+      continue;
+    }
+
+    std::string arg = "pool," + sockname + "," + std::to_string(idle) + "," +
+                      std::to_string(lockfd);
+    pid_t child;
+
+    // the shell puts the server in the background and exits, so the server
+    // is reaped by init when it exits idle instead of staying a zombie
+    if ((child = vfork()) == 0) {
+      fcntl(lockfd, F_SETFD, 0);
+      execl("/bin/sh", "sh", "-c", "\"$0\" \"$1\" &",
+            BIN_DIR "/lin-vst3-server.exe", arg.c_str(), NULL);
+      _exit(1);
+    }
+
+    if (child > 0)
+      waitpid(child, 0, 0);
+
+    close(lockfd);
+  }
+}
+#endif
+
 void errwin(std::string dllname) {
   static Window window = 0;
   static Window ignored = 0;
@@ -90,7 +272,6 @@ const char *selfname() { int i = 5; }
 
 RemoteVSTClient::RemoteVSTClient(audioMasterCallback theMaster)
     : RemotePluginClient(theMaster) {
-  pid_t child;
   Dl_info info;
   std::string dllName;
   std::string LinVstName;
@@ -265,7 +446,21 @@ RemoteVSTClient::RemoteVSTClient(audioMasterCallback theMaster)
     setenv("WINEPREFIX", hit2, 1);
   }
 
-  std::string arg = filename + "," + dllName + "," + getFileIdentifiers();
+  m_serverArg = filename + "," + dllName + "," + getFileIdentifiers();
+
+#ifdef SCANCACHE
+  // VSTPluginMain starts the server unless the scan cache can answer
+  m_scanpath = dllName;
+  m_scanpart = filename;
+  m_lazy = 1;
+#else
+  startServer();
+#endif
+}
+
+void RemoteVSTClient::startServer() {
+  pid_t child;
+  std::string arg = m_serverArg;
   const char *argStr = arg.c_str();
 
 #ifdef LVRT
@@ -279,6 +474,28 @@ RemoteVSTClient::RemoteVSTClient(audioMasterCallback theMaster)
   }
 #endif
 
+#ifdef MULTISERVER
+  std::string sockname = serverSocketName();
+
+  if (attachServer(sockname, arg)) {
+    syncStartup();
+    return;
+  }
+
+  // the new server listens on sockname for later clients
+  arg = arg + "," + sockname;
+  argStr = arg.c_str();
+#endif
+
+#ifdef SERVERPOOL
+  if (attachPool(arg)) {
+    syncStartup();
+    if (m_runok == 0)
+      fillPool();
+    return;
+  }
+#endif
+
   if ((child = vfork()) < 0) {
     m_runok = 1;
     cleanup();
@@ -291,6 +508,10 @@ RemoteVSTClient::RemoteVSTClient(audioMasterCallback theMaster)
 	  }   
   }
   syncStartup();
+#ifdef SERVERPOOL
+  if (m_runok == 0)
+    fillPool();
+#endif
 }
 
 RemoteVSTClient::~RemoteVSTClient() {
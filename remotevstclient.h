@@ -27,5 +27,10 @@ public:
   // may throw a string exception
   RemoteVSTClient(audioMasterCallback theMaster);
   virtual ~RemoteVSTClient();
+
+  virtual void startServer();
+
+private:
+  std::string m_serverArg;
 };
 #endif
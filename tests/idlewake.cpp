@@ -0,0 +1,111 @@
+/*
+  Wakeups of idle channel threads. Server threads wait on the process and
+  control channels as dispatchProcess and ControlWatchMain do, a client
+  thread waits on the callback channel. After one round trip on each the
+  plugin is left idle and the voluntary context switches of every thread
+  are read from /proc/self/task/<tid>/status before and after. An idle
+  thread that wakes up fails the test.
+
+  idlewake [idle ms]
+*/
+
+#include "shmtest.h"
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum { Process, Control, Callback, Channels };
+
+static const char *names[Channels] = {"process", "control watch", "callback"};
+
+static ShmControl *controls;
+static std::atomic_bool stop(false);
+static std::atomic_int tids[Channels];
+
+// the thread that serves channel, replies on runClient until stop is set
+static void serve(int channel) {
+  ShmControl *control = &controls[channel];
+  long long turnaround = 0;
+  long long budget = 0;
+
+  tids[channel] = syscall(SYS_gettid);
+
+  for (;;) {
+    if (channel == Control) {
+      // the watcher leaves the count for the main thread, which serves it
+      shmtestpeek(control, &control->runServer);
+      if (stop)
+        return;
+      shmtestwait(control, &control->runServer, -1);
+    } else if (!fspin(&control->runServer, budget))
+      shmtestwait(control, &control->runServer, -1);
+
+    if (stop)
+      return;
+
+    // the process thread spins for a while before its next wait
+    if (channel == Process)
+      budget = fspinbudget(&turnaround, 20000);
+
+    shmtestpost(control, &control->runClient);
+  }
+}
+
+static long long switches(int tid) {
+  std::ifstream status("/proc/self/task/" + std::to_string(tid) + "/status");
+  std::string line;
+
+  while (std::getline(status, line)) {
+    if (line.compare(0, 24, "voluntary_ctxt_switches:") == 0)
+      return atoll(line.c_str() + 24);
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  int idle = argc > 1 ? atoi(argv[1]) : 1000;
+
+  controls = (ShmControl *)shmtestmap(sizeof(ShmControl) * Channels);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < Channels; i++)
+    threads.emplace_back(serve, i);
+
+  // one request on every channel, as a plugin load would make
+  for (int i = 0; i < Channels; i++) {
+    controls[i].posttime = fnanotime();
+    shmtestpost(&controls[i], &controls[i].runServer);
+    shmtestwait(&controls[i], &controls[i].runClient, 5000);
+  }
+
+  // let every thread spin out and go back to sleep
+  usleep(100000);
+
+  long long before[Channels];
+  for (int i = 0; i < Channels; i++)
+    before[i] = switches(tids[i]);
+
+  usleep(idle * 1000);
+
+  int woken = 0;
+  printf("%d ms idle\n", idle);
+  printf("%-14s %10s\n", "thread", "wakeups");
+
+  for (int i = 0; i < Channels; i++) {
+    long long count = switches(tids[i]) - before[i];
+    printf("%-14s %10lld\n", names[i], count);
+    if (count != 0)
+      woken = 1;
+  }
+
+  stop = true;
+  for (int i = 0; i < Channels; i++)
+    shmtestpost(&controls[i], &controls[i].runServer);
+  for (std::thread &thread : threads)
+    thread.join();
+
+  printf("%s\n", woken ? "FAIL" : "ok");
+  return woken;
+}
@@ -0,0 +1,104 @@
+/*
+  False sharing on the control block. A client and a server thread bounce
+  the process channel's wake words while a third thread keeps writing the
+  string and time payloads, as the control channel does. The old packed
+  layout is timed against ShmControl.
+
+  shmbench [round trips]
+*/
+
+#include "shmtest.h"
+
+#include <thread>
+
+// the layout before the wake words got lines of their own
+struct alignas(64) OldControl {
+  std::atomic_int runServer;
+  std::atomic_int runClient;
+  std::atomic_int nwaitersserver;
+  std::atomic_int nwaitersclient;
+  RemotePluginOpcode ropcode;
+  int retint;
+  float retfloat;
+  char retstr[512];
+  int opcode;
+  int value;
+  int value2;
+  int value3;
+  int value4;
+  float floatvalue;
+  bool retbool;
+  char timeget[sizeof(VstTimeInfo)];
+  char timeset[sizeof(VstTimeInfo)];
+};
+
+// waits for the word to be posted and takes it, yields now and then so the
+// other threads get to run on a machine with few cpus
+static void take(std::atomic_int *word) {
+  for (int i = 1;; i++) {
+    int value = 1;
+    if (word->compare_exchange_weak(value, 0, std::memory_order_acquire))
+      return;
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+    if ((i & 255) == 0)
+      sched_yield();
+  }
+}
+
+template <class Control>
+static double roundtrip(Control *control, bool payload, int rounds) {
+  std::atomic_bool stop(false);
+
+  std::thread server([&] {
+    for (int i = 0; i < rounds; i++) {
+      take(&control->runServer);
+      control->retint = control->value2;
+      control->runClient.store(1, std::memory_order_release);
+    }
+  });
+
+  std::thread writer([&] {
+    for (unsigned char n = 0; payload && !stop.load(std::memory_order_relaxed);
+         n++) {
+      memset(control->retstr, n, sizeof(control->retstr));
+      memset(control->timeset, n, sizeof(control->timeset));
+      if ((n & 15) == 0)
+        sched_yield();
+    }
+  });
+
+  long long start = fnanotime();
+
+  for (int i = 0; i < rounds; i++) {
+    control->value2 = i;
+    control->runServer.store(1, std::memory_order_release);
+    take(&control->runClient);
+  }
+
+  long long ns = fnanotime() - start;
+
+  stop = true;
+  server.join();
+  writer.join();
+
+  return (double)ns / rounds;
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 50000;
+
+  OldControl *oldcontrol = (OldControl *)shmtestmap(sizeof(OldControl));
+  ShmControl *control = (ShmControl *)shmtestmap(sizeof(ShmControl));
+
+  printf("%d round trips, %ld cpus\n", rounds,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-12s %14s %14s\n", "layout", "quiet ns", "payload ns");
+  printf("%-12s %14.1f %14.1f\n", "packed", roundtrip(oldcontrol, false, rounds),
+         roundtrip(oldcontrol, true, rounds));
+  printf("%-12s %14.1f %14.1f\n", "ShmControl", roundtrip(control, false, rounds),
+         roundtrip(control, true, rounds));
+
+  return 0;
+}
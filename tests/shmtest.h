@@ -0,0 +1,99 @@
+/*
+  Standalone benchmarks and tests of the shared memory channel. They use
+  the layout and helpers of rdwrops.h, the wait and post below are the
+  ones of RemotePluginClient and RemotePluginServer.
+*/
+
+#ifndef _SHM_TEST_H_
+#define _SHM_TEST_H_
+
+#define __cdecl
+
+#include <stdint.h>
+
+typedef int16_t VstInt16;
+typedef int32_t VstInt32;
+typedef int64_t VstInt64;
+typedef intptr_t VstIntPtr;
+#define VESTIGECALLBACK __cdecl
+#include "vestige.h"
+
+#include "rdwrops.h"
+
+#include <errno.h>
+#include <linux/memfd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+// a shared mapping of sz bytes that survives fork, like the plugin segment
+inline char *shmtestmap(size_t sz) {
+  int fd = syscall(SYS_memfd_create, "rplugin_test", MFD_CLOEXEC);
+
+  if (fd < 0 || ftruncate(fd, sz) != 0) {
+    perror("memfd");
+    exit(1);
+  }
+
+  char *shm = (char *)mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+
+  memset(shm, 0, sz);
+  return shm;
+}
+
+// ms > 0 waits that long, < 0 waits until posted
+inline bool shmtestwait(ShmControl *m_shmControlptr, std::atomic_int *futexp,
+                        int ms) {
+  timespec timeval;
+  timespec *timeout = NULL;
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
+
+  if (ms > 0) {
+    timeval.tv_sec = ms / 1000;
+    timeval.tv_nsec = (ms % 1000) * 1000000;
+    timeout = &timeval;
+  }
+
+  for (;;) {
+    int value = atomic_load_explicit(futexp, std::memory_order_seq_cst);
+    if ((value != 0) &&
+        std::atomic_compare_exchange_strong(futexp, &value, value - 1))
+      break;
+    std::atomic_fetch_add_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    int retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, timeout, NULL, 0);
+    std::atomic_fetch_sub_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
+      return true;
+  }
+  return false;
+}
+
+// sleeps until something is posted but leaves the count, like fpeek
+inline bool shmtestpeek(ShmControl *m_shmControlptr, std::atomic_int *futexp) {
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
+
+  while (atomic_load_explicit(futexp, std::memory_order_seq_cst) == 0) {
+    std::atomic_fetch_add_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    int retval = syscall(SYS_futex, futexp, FUTEX_WAIT, 0, NULL, NULL, 0);
+    std::atomic_fetch_sub_explicit(nwaiters, 1, std::memory_order_seq_cst);
+    if (retval == -1 && errno != EAGAIN && errno != EINTR)
+      return true;
+  }
+  return false;
+}
+
+inline void shmtestpost(ShmControl *m_shmControlptr, std::atomic_int *futexp) {
+  std::atomic_int *nwaiters = fwaiters(m_shmControlptr, futexp);
+
+  std::atomic_fetch_add_explicit(futexp, 1, std::memory_order_seq_cst);
+
+  if (atomic_load_explicit(nwaiters, std::memory_order_seq_cst) != 0)
+    syscall(SYS_futex, futexp, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+#endif
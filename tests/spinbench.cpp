@@ -0,0 +1,113 @@
+/*
+  Process channel round trip per block size, futex only against the
+  spin-then-futex wait of SPINWAIT. A forked server stands in for the
+  wine side and busies itself for a time proportional to the block, the
+  client paces the blocks like a host at 48 kHz.
+
+  spinbench [blocks per size] [ns of plugin work per sample]
+*/
+
+#include "shmtest.h"
+
+#include <algorithm>
+#include <vector>
+
+static void busy(long long ns) {
+  long long end = fnanotime() + ns;
+  while (fnanotime() < end)
+    ;
+}
+
+// the server side of dispatchProcess
+static void server(ShmControl *control, int spin, long long nspersample) {
+  long long turnaround = 0;
+  long long budget = 0;
+  long long replytime = 0;
+
+  for (;;) {
+    if (!(spin && fspin(&control->runServer, budget)))
+      shmtestwait(control, &control->runServer, -1);
+
+    long long starttime = fnanotime();
+
+    if (spin && replytime)
+      budget = fspinbudget(&turnaround, control->posttime - replytime);
+
+    if (control->value2 < 0)
+      exit(0);
+
+    busy(control->value2 * nspersample);
+
+    replytime = fnanotime();
+    control->proctime = (int)(replytime - starttime);
+    shmtestpost(control, &control->runClient);
+  }
+}
+
+int main(int argc, char **argv) {
+  int blocks = argc > 1 ? atoi(argv[1]) : 400;
+  long long nspersample = argc > 2 ? atoll(argv[2]) : 100;
+  int sizes[] = {64, 128, 256, 512, 1024};
+
+  printf("%d blocks per size, %lld ns of work per sample, %ld cpus\n", blocks,
+         nspersample, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-6s %-6s %10s %10s %10s %8s\n", "block", "mode", "mean us",
+         "p50 us", "p99 us", "spun");
+
+  for (int spin = 0; spin < 2; spin++) {
+    ShmControl *control = (ShmControl *)shmtestmap(sizeof(ShmControl));
+
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid == 0)
+      server(control, spin, nspersample);
+
+    long long turnaround = 0;
+    long long budget = 0;
+
+    for (int size : sizes) {
+      std::vector<long long> rtt;
+      long long period = size * 1000000000LL / 48000;
+      long long next = fnanotime();
+      int spun = 0;
+
+      for (int i = 0; i < blocks; i++) {
+        control->value2 = size;
+        control->posttime = fnanotime();
+        shmtestpost(control, &control->runServer);
+
+        if (spin && fspin(&control->runClient, budget))
+          spun++;
+        else
+          shmtestwait(control, &control->runClient, -1);
+
+        rtt.push_back(fnanotime() - control->posttime);
+
+        if (spin)
+          budget = fspinbudget(&turnaround, control->proctime);
+
+        next += period;
+        timespec ts = {(time_t)(next / 1000000000LL),
+                       (long)(next % 1000000000LL)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      }
+
+      std::sort(rtt.begin(), rtt.end());
+      long long sum = 0;
+      for (long long ns : rtt)
+        sum += ns;
+
+      printf("%-6d %-6s %10.1f %10.1f %10.1f %7d%%\n", size,
+             spin ? "spin" : "futex", sum / 1000.0 / blocks,
+             rtt[blocks / 2] / 1000.0, rtt[blocks * 99 / 100] / 1000.0,
+             spun * 100 / blocks);
+    }
+
+    control->value2 = -1;
+    shmtestpost(control, &control->runServer);
+    waitpid(pid, 0, 0);
+  }
+
+  return 0;
+}
@@ -80,6 +80,9 @@ public:
 
   void _ioChanged();
   void _updateDisplay();
+#ifdef PMETA
+  void _paramTitlesChanged();
+#endif
   void _setNumInputs(int32 inputs);
   void _setNumOutputs(int32 outputs);
   bool _sizeWindow(int32 width, int32 height);
@@ -113,6 +116,9 @@ public:
 
   float getParameter(VstInt32 index);
   void setParameter(VstInt32 index, float value);
+#ifdef PARAMQUEUE
+  void setParameterAt(VstInt32 index, float value, VstInt32 sampleOffset);
+#endif
 
   void setProgram(VstInt32 program);
   void setProgramName(char *name);
@@ -124,6 +130,10 @@ public:
   void getParameterDisplay(VstInt32 index, char *text);
   void getParameterName(VstInt32 index, char *text);
   bool canParameterBeAutomated(VstInt32 index);
+#ifdef PMETA
+  bool getParameterMeta(VstInt32 index, int *automate, int *steps,
+                        int *flags, float *defvalue);
+#endif
   bool string2parameter(VstInt32 index, char *text);
 
   VstInt32 getChunk(void **data, bool isPreset = false);